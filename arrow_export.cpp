@@ -0,0 +1,407 @@
+#include "arrow_export.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "shutter_calculator.h"
+
+namespace shutter_calculator {
+    // Minimal FlatBuffers encoder, just enough to write the Arrow IPC metadata. Like the official builder it
+    // grows the buffer from the back, so every object is written before the ones referencing it and positions
+    // are counted from the end of the buffer. The metadata is a few hundred bytes, prepending is cheap enough.
+    class FlatBufferBuilder {
+    public:
+        using Offset = std::uint32_t; // Position of an object, counted from the end of the buffer
+
+        template<typename Scalar>
+        void prependScalar(const Scalar value) {
+            align(sizeof(Scalar));
+            std::array<char, sizeof(Scalar)> bytes;
+            std::memcpy(bytes.data(), &value, sizeof(Scalar)); // Arrow metadata is little endian, as is the host
+            buffer.insert(buffer.begin(), bytes.begin(), bytes.end());
+        }
+
+        void prependOffset(const Offset target) {
+            align(sizeof(Offset));
+            prependScalar<std::uint32_t>(size() + sizeof(Offset) - target);
+        }
+
+        Offset createString(const std::string_view text) {
+            align(sizeof(std::uint32_t), text.size() + 1);
+            buffer.insert(buffer.begin(), '\0');
+            buffer.insert(buffer.begin(), text.begin(), text.end());
+            prependScalar(static_cast<std::uint32_t>(text.size()));
+            return size();
+        }
+
+        Offset createOffsetVector(const std::span<const Offset> elements) {
+            align(sizeof(Offset), elements.size() * sizeof(Offset));
+            for (auto element = elements.rbegin(); element != elements.rend(); ++element) {
+                prependOffset(*element);
+            }
+            prependScalar(static_cast<std::uint32_t>(elements.size()));
+            return size();
+        }
+
+        // Structs are written as raw little endian 64-bit words, all the Arrow structs used here are made of them
+        template<std::size_t words>
+        Offset createStructVector(const std::span<const std::array<std::int64_t, words> > elements) {
+            align(sizeof(std::uint32_t), elements.size() * words * 8);
+            align(8, elements.size() * words * 8);
+            for (auto element = elements.rbegin(); element != elements.rend(); ++element) {
+                for (auto word = element->rbegin(); word != element->rend(); ++word) {
+                    prependScalar(*word);
+                }
+            }
+            prependScalar(static_cast<std::uint32_t>(elements.size()));
+            return size();
+        }
+
+        void startTable() {
+            tableStart = size();
+            fields.clear();
+        }
+
+        template<typename Scalar>
+        void addScalar(const int field, const Scalar value) {
+            prependScalar(value);
+            fields.emplace_back(field, size());
+        }
+
+        void addOffset(const int field, const Offset target) {
+            prependOffset(target);
+            fields.emplace_back(field, size());
+        }
+
+        Offset endTable() {
+            prependScalar<std::int32_t>(0); // Patched below with the distance to the vtable
+            const Offset table = size();
+
+            int fieldsCount = 0;
+            for (const auto &[field, _]: fields) {
+                fieldsCount = std::max(fieldsCount, field + 1);
+            }
+
+            std::vector<std::uint16_t> vtable(2 + fieldsCount, 0);
+            vtable[0] = static_cast<std::uint16_t>(vtable.size() * sizeof(std::uint16_t));
+            vtable[1] = static_cast<std::uint16_t>(table - tableStart);
+            for (const auto &[field, position]: fields) {
+                vtable[2 + field] = static_cast<std::uint16_t>(table - position);
+            }
+            for (auto entry = vtable.rbegin(); entry != vtable.rend(); ++entry) {
+                prependScalar(*entry);
+            }
+
+            // The vtable sits right in front of the table
+            const auto distance = static_cast<std::int32_t>(size() - table);
+            std::memcpy(buffer.data() + (size() - table), &distance, sizeof(distance));
+            return table;
+        }
+
+        std::string finish(const Offset root) {
+            align(8, sizeof(Offset));
+            prependOffset(root);
+            return std::move(buffer);
+        }
+
+    private:
+        std::string buffer;
+        Offset tableStart = 0;
+        std::vector<std::pair<int, Offset> > fields;
+
+        [[nodiscard]] Offset size() const {
+            return static_cast<Offset>(buffer.size());
+        }
+
+        // Pads so that the next `following` bytes written end up aligned to `alignment`
+        void align(const std::size_t alignment, const std::size_t following = 0) {
+            const std::size_t padding = (alignment - (buffer.size() + following) % alignment) % alignment;
+            buffer.insert(0, padding, '\0');
+        }
+    };
+
+    // Writes the exposure matrix as an Arrow IPC file (https://arrow.apache.org/docs/format/Columnar.html), one
+    // row for each shutter and filter stack pair. The formatted cell repeats a lot, so it is dictionary encoded.
+    // Every buffer starts 64 byte aligned within the file, so readers can mmap the columns without copying.
+    class ArrowMatrixWriter {
+    public:
+        static bool write(const int fd) {
+            ArrowMatrixWriter writer(fd);
+            writer.writeFile();
+            return !writer.failed;
+        }
+
+    private:
+        // Values from the Arrow Schema.fbs and Message.fbs
+        static constexpr std::int16_t metadataVersionV5 = 4;
+        static constexpr std::uint8_t headerSchema = 1;
+        static constexpr std::uint8_t headerDictionaryBatch = 2;
+        static constexpr std::uint8_t headerRecordBatch = 3;
+        static constexpr std::uint8_t typeInt = 2;
+        static constexpr std::uint8_t typeFloatingPoint = 3;
+        static constexpr std::uint8_t typeUtf8 = 5;
+        static constexpr std::int16_t precisionDouble = 2;
+        static constexpr std::int64_t cellDictionaryId = 0;
+        static constexpr std::size_t bufferAlignment = 64;
+        static constexpr std::string_view magic{"ARROW1\0\0", 8};
+
+        using Block = std::array<std::int64_t, 3>; // offset, metadata length (padded to 8B), body length
+        using FieldNode = std::array<std::int64_t, 2>; // length, null count
+        using Buffer = std::array<std::int64_t, 2>; // offset within the body, length
+
+        const int fd;
+        std::uint64_t position = 0;
+        bool failed = false;
+        std::vector<Block> dictionaryBlocks;
+        std::vector<Block> recordBatchBlocks;
+
+        explicit ArrowMatrixWriter(const int initFd) : fd(initFd) {
+        }
+
+        void writeBytes(const std::string_view bytes) {
+            failed = !shutter_calculator::writeAll(fd, bytes) || failed;
+            position += bytes.size();
+        }
+
+        static FlatBufferBuilder::Offset addIntType(FlatBufferBuilder &builder, const std::int32_t bitWidth) {
+            builder.startTable();
+            builder.addScalar<std::int32_t>(0, bitWidth);
+            builder.addScalar<std::uint8_t>(1, 1); // is_signed
+            return builder.endTable();
+        }
+
+        static FlatBufferBuilder::Offset addField(FlatBufferBuilder &builder, const std::string_view name,
+                                                  const std::uint8_t typeType, const FlatBufferBuilder::Offset type,
+                                                  const std::optional<FlatBufferBuilder::Offset> dictionary = {}) {
+            const auto nameOffset = builder.createString(name);
+            const auto children = builder.createOffsetVector({});
+            builder.startTable();
+            builder.addOffset(0, nameOffset);
+            builder.addScalar<std::uint8_t>(1, 0); // nullable
+            builder.addScalar<std::uint8_t>(2, typeType);
+            builder.addOffset(3, type);
+            if (dictionary) {
+                builder.addOffset(4, *dictionary);
+            }
+            builder.addOffset(5, children);
+            return builder.endTable();
+        }
+
+        static FlatBufferBuilder::Offset addSchema(FlatBufferBuilder &builder) {
+            const auto addDouble = [&builder](const std::string_view name) {
+                builder.startTable();
+                builder.addScalar<std::int16_t>(0, precisionDouble);
+                const auto type = builder.endTable();
+                return addField(builder, name, typeFloatingPoint, type);
+            };
+            const auto addInt32 = [&builder](const std::string_view name) {
+                return addField(builder, name, typeInt, addIntType(builder, 32));
+            };
+
+            std::array<FlatBufferBuilder::Offset, 5> fields{};
+            fields[0] = addDouble("base_shutter_seconds");
+            fields[1] = addInt32("stack_id");
+            fields[2] = addInt32("stops");
+            fields[3] = addDouble("duration_seconds");
+
+            const auto indexType = addIntType(builder, 32);
+            builder.startTable();
+            builder.addScalar<std::int64_t>(0, cellDictionaryId);
+            builder.addOffset(1, indexType);
+            const auto dictionary = builder.endTable();
+            builder.startTable();
+            const auto utf8 = builder.endTable();
+            fields[4] = addField(builder, "cell", typeUtf8, utf8, dictionary);
+
+            const auto fieldsVector = builder.createOffsetVector(fields);
+            builder.startTable();
+            builder.addScalar<std::int16_t>(0, 0); // little endian
+            builder.addOffset(1, fieldsVector);
+            return builder.endTable();
+        }
+
+        static FlatBufferBuilder::Offset addRecordBatch(FlatBufferBuilder &builder, const std::int64_t length,
+                                                        const std::span<const FieldNode> nodes,
+                                                        const std::span<const Buffer> buffers) {
+            const auto nodesVector = builder.createStructVector<2>(nodes);
+            const auto buffersVector = builder.createStructVector<2>(buffers);
+            builder.startTable();
+            builder.addScalar<std::int64_t>(0, length);
+            builder.addOffset(1, nodesVector);
+            builder.addOffset(2, buffersVector);
+            return builder.endTable();
+        }
+
+        static std::string finishMessage(FlatBufferBuilder &builder, const std::uint8_t headerType,
+                                         const FlatBufferBuilder::Offset header, const std::int64_t bodyLength) {
+            builder.startTable();
+            builder.addScalar<std::int64_t>(3, bodyLength);
+            builder.addOffset(2, header);
+            builder.addScalar<std::int16_t>(0, metadataVersionV5);
+            builder.addScalar<std::uint8_t>(1, headerType);
+            return builder.finish(builder.endTable());
+        }
+
+        // Encapsulated message: continuation marker, metadata length, metadata padded so the body that follows
+        // starts on a 64 byte boundary, then the body buffers
+        Block writeMessage(const std::string &metadata, const std::span<const std::string_view> bodyBuffers) {
+            const std::uint64_t start = position;
+            std::uint64_t metadataLength = 8 + metadata.size();
+            metadataLength += (bufferAlignment - (start + metadataLength) % bufferAlignment) % bufferAlignment;
+
+            std::string prefix(8, '\0');
+            const std::uint32_t continuation = 0xFFFFFFFF;
+            const auto length = static_cast<std::int32_t>(metadataLength - 8);
+            std::memcpy(prefix.data(), &continuation, 4);
+            std::memcpy(prefix.data() + 4, &length, 4);
+            writeBytes(prefix);
+            writeBytes(metadata);
+            writeBytes(std::string(metadataLength - 8 - metadata.size(), '\0'));
+
+            const std::uint64_t bodyStart = position;
+            for (const auto buffer: bodyBuffers) {
+                writeBytes(buffer);
+                writeBytes(std::string(paddedLength(buffer.size()) - buffer.size(), '\0'));
+            }
+
+            return {
+                static_cast<std::int64_t>(start), static_cast<std::int64_t>(metadataLength),
+                static_cast<std::int64_t>(position - bodyStart)
+            };
+        }
+
+        static std::size_t paddedLength(const std::size_t length) {
+            return (length + bufferAlignment - 1) / bufferAlignment * bufferAlignment;
+        }
+
+        // Describes the buffers as they will be laid out in the body, each one padded to the alignment
+        static std::vector<Buffer> layoutBuffers(const std::span<const std::string_view> bodyBuffers) {
+            std::vector<Buffer> buffers;
+            std::int64_t offset = 0;
+            for (const auto buffer: bodyBuffers) {
+                buffers.push_back({offset, static_cast<std::int64_t>(buffer.size())});
+                offset += static_cast<std::int64_t>(paddedLength(buffer.size()));
+            }
+            return buffers;
+        }
+
+        template<typename Value>
+        static std::string_view bytesOf(const std::vector<Value> &values) {
+            return {reinterpret_cast<const char *>(values.data()), values.size() * sizeof(Value)};
+        }
+
+        void writeFile() {
+            const std::size_t rows = shutters.size() * combinedFilters.size();
+            std::vector<double> baseShutters;
+            std::vector<std::int32_t> stackIds;
+            std::vector<std::int32_t> stops;
+            std::vector<double> durations;
+            std::vector<std::int32_t> cellIndices;
+            baseShutters.reserve(rows);
+            stackIds.reserve(rows);
+            stops.reserve(rows);
+            durations.reserve(rows);
+            cellIndices.reserve(rows);
+
+            std::unordered_map<std::string, std::int32_t> dictionaryIndex;
+            std::vector<std::int32_t> dictionaryOffsets = {0};
+            std::string dictionaryData;
+
+            for (const auto &shutter: shutters) {
+                for (std::size_t stack = 0; stack < combinedFilters.size(); stack++) {
+                    const int filterStops = combinedFilters[stack].stops;
+                    baseShutters.push_back(shutter.time);
+                    stackIds.push_back(static_cast<std::int32_t>(stack));
+                    stops.push_back(filterStops);
+                    durations.push_back(shutter.timeWithFilterStops(filterStops));
+
+                    auto [entry, inserted] = dictionaryIndex.try_emplace(
+                        shutter.toStringWithFilterStops(filterStops),
+                        static_cast<std::int32_t>(dictionaryIndex.size()));
+                    if (inserted) {
+                        dictionaryData += entry->first;
+                        dictionaryOffsets.push_back(static_cast<std::int32_t>(dictionaryData.size()));
+                    }
+                    cellIndices.push_back(entry->second);
+                }
+            }
+
+            writeBytes(magic);
+
+            {
+                FlatBufferBuilder builder;
+                writeMessage(finishMessage(builder, headerSchema, addSchema(builder), 0), {});
+            }
+
+            {
+                const std::array<std::string_view, 3> body = {
+                    std::string_view(), bytesOf(dictionaryOffsets), dictionaryData
+                };
+                const std::array<FieldNode, 1> nodes = {{{static_cast<std::int64_t>(dictionaryIndex.size()), 0}}};
+                const auto buffers = layoutBuffers(body);
+
+                FlatBufferBuilder builder;
+                const auto data = addRecordBatch(builder, nodes[0][0], nodes, buffers);
+                builder.startTable();
+                builder.addScalar<std::int64_t>(0, cellDictionaryId);
+                builder.addOffset(1, data);
+                const auto header = builder.endTable();
+                dictionaryBlocks.push_back(writeMessage(
+                    finishMessage(builder, headerDictionaryBatch, header, buffers.back()[0] + static_cast<std::int64_t>(
+                                      paddedLength(body.back().size()))), body));
+            }
+
+            {
+                // Every column is non-nullable, the validity bitmaps are left empty
+                const std::array<std::string_view, 10> body = {
+                    std::string_view(), bytesOf(baseShutters),
+                    std::string_view(), bytesOf(stackIds),
+                    std::string_view(), bytesOf(stops),
+                    std::string_view(), bytesOf(durations),
+                    std::string_view(), bytesOf(cellIndices)
+                };
+                std::array<FieldNode, 5> nodes;
+                nodes.fill({static_cast<std::int64_t>(rows), 0});
+                const auto buffers = layoutBuffers(body);
+
+                FlatBufferBuilder builder;
+                const auto header = addRecordBatch(builder, static_cast<std::int64_t>(rows), nodes, buffers);
+                recordBatchBlocks.push_back(writeMessage(
+                    finishMessage(builder, headerRecordBatch, header, buffers.back()[0] + static_cast<std::int64_t>(
+                                      paddedLength(body.back().size()))), body));
+            }
+
+            // End of stream marker, followed by the footer which repeats the schema and indexes the batches
+            writeBytes(std::string_view("\xFF\xFF\xFF\xFF\x00\x00\x00\x00", 8));
+
+            FlatBufferBuilder builder;
+            const auto dictionaries = builder.createStructVector<3>(dictionaryBlocks);
+            const auto recordBatches = builder.createStructVector<3>(recordBatchBlocks);
+            const auto schema = addSchema(builder);
+            builder.startTable();
+            builder.addOffset(1, schema);
+            builder.addOffset(2, dictionaries);
+            builder.addOffset(3, recordBatches);
+            builder.addScalar<std::int16_t>(0, metadataVersionV5);
+            const std::string footer = builder.finish(builder.endTable());
+
+            const auto footerLength = static_cast<std::int32_t>(footer.size());
+            std::string footerLengthBytes(4, '\0');
+            std::memcpy(footerLengthBytes.data(), &footerLength, 4);
+            writeBytes(footer);
+            writeBytes(footerLengthBytes);
+            writeBytes(magic.substr(0, 6));
+        }
+    };
+
+    bool writeArrowFile(const int fd) {
+        return ArrowMatrixWriter::write(fd);
+    }
+} // end of namespace
@@ -0,0 +1,7 @@
+// Export of the exposure matrix as an Arrow IPC file
+#pragma once
+
+namespace shutter_calculator {
+    // Writes the exposure matrix of the current kit, false when the file couldn't be written
+    bool writeArrowFile(int fd);
+} // end of namespace
@@ -0,0 +1,139 @@
+#include "compact_table.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace shutter_calculator {
+    std::uint64_t zigzag(const std::int64_t value) {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    std::int64_t unzigzag(const std::uint64_t value) {
+        return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+    }
+
+    std::optional<std::string> encodeCompactTable(const std::span<const Filter> kit,
+                                                  const std::span<const Filter> stacks,
+                                                  const std::span<const Shutter> ladder) {
+        // The stacks are stored as 8-bit masks of the kit filters
+        if (kit.size() > 8) {
+            return std::nullopt;
+        }
+
+        std::string bytes(1, static_cast<char>(CompactTable::version));
+        appendVarint(bytes, kit.size());
+        for (const auto &filter: kit) {
+            if (filter.stops < 0 || filter.stops > CompactTable::maximalStops) {
+                return std::nullopt;
+            }
+            appendVarint(bytes, static_cast<std::uint64_t>(filter.stops));
+            appendVarint(bytes, filter.name.size());
+            bytes += filter.name;
+        }
+
+        appendVarint(bytes, stacks.size());
+        for (const auto &stack: stacks) {
+            if (stack.stops > CompactTable::maximalStops) {
+                return std::nullopt;
+            }
+            std::uint8_t mask = 0;
+            for (const auto word: std::views::split(std::string_view(stack.name), ' ')) {
+                const auto found = std::ranges::find(kit, std::string_view(word.begin(), word.end()), &Filter::name);
+                if (found == kit.end()) {
+                    return std::nullopt;
+                }
+                mask |= static_cast<std::uint8_t>(1u << (found - kit.begin()));
+            }
+            if (mask == 0) {
+                return std::nullopt;
+            }
+            bytes.push_back(static_cast<char>(mask));
+        }
+
+        appendVarint(bytes, ladder.size());
+        for (const auto &shutter: ladder) {
+            appendVarint(bytes, shutter.numerator == 1
+                                    ? zigzag(shutter.denominator)
+                                    : zigzag(-static_cast<std::int64_t>(shutter.numerator)));
+        }
+        return bytes;
+    }
+
+    std::optional<CompactTable> decodeCompactTable(const std::string_view bytes) {
+        if (bytes.empty() || static_cast<std::uint8_t>(bytes[0]) != CompactTable::version) {
+            return std::nullopt;
+        }
+
+        CompactTable table;
+        std::size_t position = 1;
+
+        const auto kitSize = readVarint(bytes, position);
+        for (std::uint64_t i = 0; kitSize && *kitSize <= 8 && i < *kitSize; i++) {
+            const auto stops = readVarint(bytes, position);
+            const auto nameLength = readVarint(bytes, position);
+            if (!stops || !nameLength || *stops > CompactTable::maximalStops || *nameLength > bytes.size() - position) {
+                return std::nullopt;
+            }
+            table.kit.push_back({
+                .stops = static_cast<int>(*stops),
+                .name = std::string(bytes.substr(position, *nameLength))
+            });
+            position += *nameLength;
+        }
+
+        const auto stacksCount = readVarint(bytes, position);
+        if (!kitSize || table.kit.size() != *kitSize || !stacksCount || *stacksCount > bytes.size() - position) {
+            return std::nullopt;
+        }
+        table.stackMasks.assign(bytes.begin() + static_cast<std::ptrdiff_t>(position),
+                                bytes.begin() + static_cast<std::ptrdiff_t>(position + *stacksCount));
+        position += *stacksCount;
+
+        for (std::size_t column = 0; column < table.columns(); column++) {
+            const std::uint8_t mask = table.stackMasks[column];
+            if (mask == 0 || mask >> table.kit.size() != 0) {
+                return std::nullopt; // Empty, or using filters the kit doesn't have
+            }
+            const int stops = table.stack(column).stops;
+            if (stops > CompactTable::maximalStops) {
+                return std::nullopt;
+            }
+            table.stackStops.push_back(static_cast<std::uint8_t>(stops));
+        }
+
+        const auto ladderSize = readVarint(bytes, position);
+        for (std::uint64_t i = 0; ladderSize && i < *ladderSize; i++) {
+            const auto encoded = readVarint(bytes, position);
+            if (!encoded) {
+                return std::nullopt;
+            }
+            // 1/x with x > 0, or a whole number of tenths of a second > 0, and both fitting an int
+            const std::int64_t value = unzigzag(*encoded);
+            if (value == 0 || value > std::numeric_limits<int>::max() || -value > std::numeric_limits<int>::max()) {
+                return std::nullopt;
+            }
+            table.ladder.push_back(value > 0
+                                       ? Shutter(static_cast<int>(value))
+                                       : Shutter(static_cast<int>(-value / 10), static_cast<int>(-value % 10)));
+        }
+        if (!ladderSize || position != bytes.size()) {
+            return std::nullopt;
+        }
+
+        // The formatter counts the seconds of a cell in an int, the longest one is the longest shutter under the
+        // longest stack
+        if (!table.ladder.empty() && !table.stackStops.empty() &&
+            std::ldexp(std::ranges::max(table.ladder, {}, &Shutter::time).time, std::ranges::max(table.stackStops)) >=
+            std::numeric_limits<int>::max()) {
+            return std::nullopt;
+        }
+        return table;
+    }
+} // end of namespace
@@ -0,0 +1,61 @@
+// Compact binary form of the table, for flash limited intervalometers and QR codes
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "shutter_calculator.h"
+
+namespace shutter_calculator {
+    // Compact binary form of the table for flash limited intervalometers and QR codes. Nothing is stored as text
+    // except the filter names, the cells are turned back into text by the formatter when they are displayed:
+    //   version byte
+    //   kit:    count, then stops and name (length + bytes) for each filter
+    //   stacks: count, then a bitmask of the kit filters in each stack (names and stops follow from the kit)
+    //   ladder: count, then each shutter as a zigzag varint, 1/x as x and tenths of a second as -tenths
+    // No cell is stored, each one is its row's shutter lengthened by its column's stack stops, both already known.
+    // The input comes from QR codes and phones, the decoder rejects anything the formatter can't print safely.
+    struct CompactTable {
+        std::vector<Filter> kit;
+        std::vector<std::uint8_t> stackMasks;
+        std::vector<Shutter> ladder;
+        std::vector<std::uint8_t> stackStops; // Stops of each column's stack, derived from the masks when decoding
+
+        static constexpr std::uint8_t version = 2;
+
+        // Keeps a stack's stops in a byte, the seconds of the longest cell must also fit an int (checked when decoding)
+        static constexpr int maximalStops = 30;
+
+        [[nodiscard]] std::size_t columns() const {
+            return stackMasks.size();
+        }
+
+        [[nodiscard]] Filter stack(const std::size_t column) const {
+            std::optional<Filter> combined;
+            for (std::size_t i = 0; i < kit.size(); i++) {
+                if (stackMasks[column] & (1u << i)) {
+                    combined = combined ? *combined + kit[i] : kit[i];
+                }
+            }
+            return combined.value_or(Filter{.stops = 0, .name = "", .count = 0});
+        }
+
+        template<typename Style = Canon90dStyle>
+        [[nodiscard]] std::string cellText(const std::size_t row, const std::size_t column) const {
+            return ladder[row].toStringWithFilterStops<Style>(stackStops[column]);
+        }
+    };
+
+    // Fails when the kit has more than 8 filters, or a filter or a stack isn't one the decoder accepts, or a stack
+    // isn't made of the kit filters
+    std::optional<std::string> encodeCompactTable(std::span<const Filter> kit, std::span<const Filter> stacks,
+                                                  std::span<const Shutter> ladder);
+
+    // Nothing when the bytes are truncated, malformed or describe a table the formatter can't print safely
+    std::optional<CompactTable> decodeCompactTable(std::string_view bytes);
+} // end of namespace
@@ -0,0 +1,264 @@
+#include "gzip_stream.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "shutter_calculator.h"
+
+namespace shutter_calculator {
+    // Dependency free deflate (RFC 1951) encoder for one independent block of input. LZ77 with hash chains finds
+    // the matches, which are then coded with the fixed Huffman tables. The tables are made of the same cells and
+    // headers over and over, so long matches dominate and the dynamic Huffman tables would gain little.
+    // The block ends with a sync flush (empty stored block), so its output is byte aligned and the compressed
+    // blocks can simply be concatenated into one stream.
+    class DeflateBlock {
+    public:
+        static std::string compress(const std::string_view input) {
+            DeflateBlock block;
+            block.output.reserve(input.size() / 4 + 64);
+            block.writeBits(0, 1); // BFINAL, the stream is closed by an empty final block
+            block.writeBits(1, 2); // BTYPE = fixed Huffman
+            block.encode(input);
+            block.writeLiteralOrLength(endOfBlock);
+
+            // Sync flush: an empty stored block aligns the output to a whole byte
+            block.writeBits(0, 3);
+            block.alignToByte();
+            block.output.append("\x00\x00\xFF\xFF", 4);
+            return std::move(block.output);
+        }
+
+        // Empty block with BFINAL set, terminates a stream made of compress() outputs
+        static std::string finalBlock() {
+            DeflateBlock block;
+            block.writeBits(1, 1);
+            block.writeBits(1, 2);
+            block.writeLiteralOrLength(endOfBlock);
+            block.alignToByte();
+            return std::move(block.output);
+        }
+
+    private:
+        static constexpr int endOfBlock = 256;
+        static constexpr std::size_t minimalMatch = 3;
+        static constexpr std::size_t maximalMatch = 258;
+        static constexpr std::size_t window = 32768;
+        static constexpr int maximalChain = 64;
+        static constexpr int hashBits = 15;
+
+        static constexpr std::array<std::uint16_t, 29> lengthBase = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195,
+            227, 258
+        };
+        static constexpr std::array<std::uint8_t, 29> lengthExtraBits = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+        };
+        static constexpr std::array<std::uint16_t, 30> distanceBase = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+            4097, 6145, 8193, 12289, 16385, 24577
+        };
+        static constexpr std::array<std::uint8_t, 30> distanceExtraBits = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+        };
+
+        std::string output;
+        std::uint64_t bitBuffer = 0;
+        int bitCount = 0;
+
+        // Deflate packs values starting from the least significant bit
+        void writeBits(const std::uint32_t value, const int count) {
+            bitBuffer |= static_cast<std::uint64_t>(value) << bitCount;
+            bitCount += count;
+            while (bitCount >= 8) {
+                output.push_back(static_cast<char>(bitBuffer));
+                bitBuffer >>= 8;
+                bitCount -= 8;
+            }
+        }
+
+        void alignToByte() {
+            if (bitCount > 0) {
+                writeBits(0, 8 - bitCount);
+            }
+        }
+
+        // Huffman codes are stored starting from their most significant bit
+        void writeHuffman(const std::uint32_t code, const int length) {
+            std::uint32_t reversed = 0;
+            for (int bit = 0; bit < length; bit++) {
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            }
+            writeBits(reversed, length);
+        }
+
+        void writeLiteralOrLength(const int symbol) {
+            if (symbol < 144) {
+                writeHuffman(0x30 + symbol, 8);
+            } else if (symbol < 256) {
+                writeHuffman(0x190 + symbol - 144, 9);
+            } else if (symbol < 280) {
+                writeHuffman(symbol - 256, 7);
+            } else {
+                writeHuffman(0xC0 + symbol - 280, 8);
+            }
+        }
+
+        void writeMatch(const std::size_t length, const std::size_t distance) {
+            const auto lengthCode = static_cast<std::size_t>(
+                std::upper_bound(lengthBase.begin(), lengthBase.end(), length) - lengthBase.begin() - 1);
+            writeLiteralOrLength(257 + static_cast<int>(lengthCode));
+            writeBits(length - lengthBase[lengthCode], lengthExtraBits[lengthCode]);
+
+            const auto distanceCode = static_cast<std::size_t>(
+                std::upper_bound(distanceBase.begin(), distanceBase.end(), distance) - distanceBase.begin() - 1);
+            writeHuffman(distanceCode, 5);
+            writeBits(distance - distanceBase[distanceCode], distanceExtraBits[distanceCode]);
+        }
+
+        static std::uint32_t hashAt(const std::string_view input, const std::size_t position) {
+            const auto byte = [&](const std::size_t offset) {
+                return static_cast<std::uint32_t>(static_cast<unsigned char>(input[position + offset]));
+            };
+            return ((byte(0) << 16 | byte(1) << 8 | byte(2)) * 2654435761u) >> (32 - hashBits);
+        }
+
+        void encode(const std::string_view input) {
+            std::vector<std::int32_t> head(1 << hashBits, -1);
+            std::vector<std::int32_t> previous(input.size(), -1);
+
+            const auto insert = [&](const std::size_t position) {
+                if (position + minimalMatch <= input.size()) {
+                    const std::uint32_t hash = hashAt(input, position);
+                    previous[position] = head[hash];
+                    head[hash] = static_cast<std::int32_t>(position);
+                }
+            };
+
+            std::size_t position = 0;
+            while (position < input.size()) {
+                std::size_t bestLength = 0;
+                std::size_t bestDistance = 0;
+
+                if (position + minimalMatch <= input.size()) {
+                    const std::size_t limit = std::min(maximalMatch, input.size() - position);
+                    std::int32_t candidate = head[hashAt(input, position)];
+
+                    for (int chain = 0; candidate >= 0 && chain < maximalChain; chain++) {
+                        const auto distance = position - static_cast<std::size_t>(candidate);
+                        if (distance > window) {
+                            break;
+                        }
+
+                        std::size_t length = 0;
+                        while (length < limit && input[candidate + length] == input[position + length]) {
+                            length++;
+                        }
+                        if (length > bestLength) {
+                            bestLength = length;
+                            bestDistance = distance;
+                            if (length == limit) {
+                                break;
+                            }
+                        }
+                        candidate = previous[candidate];
+                    }
+                }
+
+                if (bestLength >= minimalMatch) {
+                    writeMatch(bestLength, bestDistance);
+                    for (std::size_t i = 0; i < bestLength; i++) {
+                        insert(position + i);
+                    }
+                    position += bestLength;
+                } else {
+                    writeLiteralOrLength(static_cast<unsigned char>(input[position]));
+                    insert(position);
+                    position++;
+                }
+            }
+        }
+    };
+
+    std::uint32_t crc32Update(std::uint32_t crc, const std::string_view data) {
+        static constexpr auto table = [] {
+            std::array<std::uint32_t, 256> entries{};
+            for (std::uint32_t i = 0; i < 256; i++) {
+                std::uint32_t value = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+                }
+                entries[i] = value;
+            }
+            return entries;
+        }();
+
+        crc = ~crc;
+        for (const char character: data) {
+            crc = table[(crc ^ static_cast<unsigned char>(character)) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    GzipStream::GzipStream(const int initFd) : fd(initFd),
+                                               maximalInFlight(2 * std::max(1u, std::thread::hardware_concurrency())) {
+        // Magic, deflate, no flags, no modification time, no extra flags, Unix
+        failed = !writeAll(fd, std::string_view("\x1F\x8B\x08\x00\x00\x00\x00\x00\x00\x03", 10));
+    }
+
+    void GzipStream::write(std::string_view data) {
+        crc = crc32Update(crc, data);
+        size += data.size();
+
+        while (!data.empty()) {
+            const std::size_t taken = std::min(data.size(), blockSize - pending.size());
+            pending.append(data.substr(0, taken));
+            data.remove_prefix(taken);
+            if (pending.size() == blockSize) {
+                submitPending();
+            }
+        }
+    }
+
+    bool GzipStream::finish() {
+        submitPending();
+        while (!inFlight.empty()) {
+            writeOldest();
+        }
+
+        std::string trailer = DeflateBlock::finalBlock();
+        for (int i = 0; i < 4; i++) {
+            trailer.push_back(static_cast<char>(crc >> (8 * i)));
+        }
+        for (int i = 0; i < 4; i++) {
+            trailer.push_back(static_cast<char>(size >> (8 * i))); // ISIZE is the size modulo 2^32
+        }
+        failed = failed || !writeAll(fd, trailer);
+        return !failed;
+    }
+
+    void GzipStream::submitPending() {
+        if (pending.empty()) {
+            return;
+        }
+        if (inFlight.size() >= maximalInFlight) {
+            writeOldest();
+        }
+        inFlight.push_back(workerPool.submit([block = std::move(pending), item = blocksCount++] {
+            const ScopedTrace trace("deflate", item);
+            return DeflateBlock::compress(block);
+        }));
+        pending.clear();
+    }
+
+    void GzipStream::writeOldest() {
+        const std::string block = inFlight.front().get();
+        const ScopedTrace trace("write");
+        failed = failed || !writeAll(fd, block);
+        inFlight.pop_front();
+    }
+} // end of namespace
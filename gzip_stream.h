@@ -0,0 +1,43 @@
+// Dependency free gzip writer, deflating blocks on the worker pool
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <string>
+#include <string_view>
+
+namespace shutter_calculator {
+    // CRC-32 (the gzip and zlib one) of data, continuing from the CRC of what came before it
+    std::uint32_t crc32Update(std::uint32_t crc, std::string_view data);
+
+    // Streaming gzip (RFC 1952) writer in the style of pigz: the input is cut into independent blocks which are
+    // deflated by the worker pool while the table is still being generated, and written out in their original
+    // order as soon as they are done
+    class GzipStream {
+    public:
+        explicit GzipStream(int initFd);
+
+        void write(std::string_view data);
+
+        // False when any part of the stream couldn't be written, the file is then unusable
+        bool finish();
+
+    private:
+        static constexpr std::size_t blockSize = 128 * 1024;
+
+        const int fd;
+        const std::size_t maximalInFlight;
+        std::string pending;
+        std::deque<std::future<std::string> > inFlight;
+        std::uint32_t crc = 0;
+        std::uint64_t size = 0;
+        std::int64_t blocksCount = 0;
+        bool failed = false;
+
+        void submitPending();
+
+        // After a failed write the blocks are still waited for but dropped
+        void writeOldest();
+    };
+} // end of namespace
@@ -1,166 +1,252 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <cerrno>
+#include <climits>
 #include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <format>
-#include <iostream>
+#include <functional>
+#include <future>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "arrow_export.h"
+#include "compact_table.h"
+#include "shutter_calculator.h"
+#include "sweep.h"
+#include "sweep_queue.h"
+#include "table_viewer.h"
+
 namespace shutter_calculator {
-    struct Filter {
-        int stops;
-        std::string name;
+    std::atomic<bool> tracingEnabled = false;
+    const auto traceEpoch = std::chrono::steady_clock::now();
 
-        auto constexpr operator<=>(const Filter &other) const {
-            return stops <=> other.stops;
-        }
+    std::mutex traceRingsMutex;
+    std::vector<std::unique_ptr<TraceRing> > traceRings;
 
-        Filter constexpr operator+(const Filter &other) const {
-            return {
-                .stops = this->stops + other.stops,
-                .name = this->name + " " + other.name
-            };
+    TraceRing &threadTraceRing() {
+        thread_local TraceRing &ring = [] -> TraceRing & {
+            std::lock_guard lock(traceRingsMutex);
+            auto &created = *traceRings.emplace_back(std::make_unique<TraceRing>());
+            created.threadId = static_cast<std::uint32_t>(traceRings.size());
+            return created;
+        }();
+        return ring;
+    }
+
+    std::uint64_t traceNow() {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - traceEpoch).count());
+    }
+
+    // Writes everything, retrying short writes and interrupted calls
+    bool writeAll(const int fd, const std::string_view data) {
+        std::size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                return false;
+            }
+            written += static_cast<std::size_t>(result);
         }
+        return true;
+    }
 
-        [[nodiscard]] std::string toString() const {
-            return std::format("{: >7}", name);
+    // writeAll for several buffers, which go out in order with as few writev(2) calls as possible
+    bool writevAll(const int fd, const std::span<const std::string> buffers) {
+        std::vector<iovec> vectors;
+        vectors.reserve(buffers.size());
+        for (const auto &buffer: buffers) {
+            if (!buffer.empty()) {
+                vectors.push_back({.iov_base = const_cast<char *>(buffer.data()), .iov_len = buffer.size()});
+            }
         }
-    };
 
-    struct Shutter {
-        double time;
+        std::size_t next = 0;
+        while (next < vectors.size()) {
+            const auto count = static_cast<int>(std::min<std::size_t>(vectors.size() - next, IOV_MAX));
+            const ssize_t result = ::writev(fd, vectors.data() + next, count);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                return false;
+            }
 
-        explicit constexpr Shutter(const int initFraction) {
-            time = 1.0 / initFraction;
+            // A short write can stop in the middle of a buffer
+            auto written = static_cast<std::size_t>(result);
+            while (next < vectors.size() && written >= vectors[next].iov_len) {
+                written -= vectors[next++].iov_len;
+            }
+            if (written > 0) {
+                vectors[next].iov_base = static_cast<char *>(vectors[next].iov_base) + written;
+                vectors[next].iov_len -= written;
+            }
         }
+        return true;
+    }
 
-        explicit constexpr Shutter(const int initSeconds, const int initHundredsMiliseconds) {
-            time = initSeconds + initHundredsMiliseconds / 10.0;
-        }
+    // Defined before the standard output, whose gzip stream still submits blocks when it is closed at exit
+    WorkerPool workerPool;
 
-        [[nodiscard]] std::string toStringWithFilterStops(const int stops) const {
-            // Increase the shutter time first by x amount of stops and then print it
-            const double increasedShutterTime = time * (1 << stops);
-            return doubleToString(increasedShutterTime);
+    // The whole file, nothing when it can't be opened or read
+    std::optional<std::string> readFile(const std::string &path) {
+        const int file = open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            return std::nullopt;
         }
 
-        [[nodiscard]] std::string toString() const {
-            return doubleToString(time);
+        std::string bytes;
+        std::array<char, 1 << 16> chunk;
+        while (true) {
+            const ssize_t result = ::read(file, chunk.data(), chunk.size());
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                ::close(file);
+                return result == 0 ? std::optional(std::move(bytes)) : std::nullopt;
+            }
+            bytes.append(chunk.data(), static_cast<std::size_t>(result));
         }
+    }
 
-    private:
-        [[nodiscard]] static std::string doubleToString(const double input) {
-            if (input <= 0.25) {
-                // Regular fraction format 1/x is used upto 1s/4
-                return std::format("{:7}", static_cast<int>(std::round(1.0 / input)));
-            } else if (input <= 30.0) {
-                // Regular s"ms format used between 1s/4 and 30s
-                int second = std::floor(input);
-                int leftOver = static_cast<int>(std::round((input - second) * 10));
-                return std::format("{:5}\"{}", second, leftOver);
-            }
+    FdWriter standardOutput(STDOUT_FILENO);
 
-            // It's longer than 30 seconds, need to use BULB mode format
-            const int secondTotal = std::ceil(input);
-            const int minutesTotal = secondTotal / 60;
-            const int seconds = secondTotal % 60;
+    // Errors are not buffered, the whole message and its new line go out in one write(2)
+    void reportError(const std::string_view message) {
+        FdWriter error(STDERR_FILENO);
+        error << message << '\n';
+    }
 
-            if (minutesTotal <= 60) {
-                // it's under 1h then do not display hours yet
-                return std::format("{:2}' {:02}\"", minutesTotal, seconds);
+    // Chrome trace event format, every event is a complete ("X") event with the timestamps in microseconds
+    bool writeChromeTrace(const std::string &path) {
+        std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+        bool first = true;
+        std::lock_guard lock(traceRingsMutex);
+        for (const auto &ring: traceRings) {
+            const std::uint64_t recorded = ring->recorded.load(std::memory_order_acquire);
+            const std::uint64_t oldest = recorded > TraceRing::capacity ? recorded - TraceRing::capacity : 0;
+            for (std::uint64_t i = oldest; i < recorded; i++) {
+                const auto &[name, startNs, durationNs, item] = ring->at(i);
+                json += first ? "" : ",\n";
+                json += std::format(R"({{"name":"{}","ph":"X","pid":1,"tid":{},"ts":{:.3f},"dur":{:.3f})", name,
+                                    ring->threadId, static_cast<double>(startNs) / 1000.0,
+                                    static_cast<double>(durationNs) / 1000.0);
+                json += item >= 0 ? std::format(R"(,"args":{{"item":{}}}}})", item) : "}";
+                first = false;
             }
+        }
+        json += "\n]}\n";
 
-            // It's over 60mins
-            const int hours = minutesTotal / 60;
-            const int minutes = minutesTotal % 60;
+        const int file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const bool written = file >= 0 && writeAll(file, json);
+        if (file >= 0) {
+            ::close(file);
+        }
+        return written;
+    }
 
-            if (hours > 99) {
-                // Canon 90D can't record for longer than 99h in BULB mode, no point to display anything
-                return std::format("{:7}", 'x');
-            }
+    // Writes the trace when main returns, whichever mode ran
+    class TraceDump {
+    public:
+        explicit TraceDump(std::string initPath) : path(std::move(initPath)) {
+            tracingEnabled.store(!path.empty(), std::memory_order_relaxed);
+        }
 
-            // Display BULB hours and minutes (but omit seconds)
-            return std::format("{:2}h {:02}'", hours, minutes);
+        ~TraceDump() {
+            if (!path.empty()) {
+                standardOutput.close(); // Lets the pending writes show up in the timeline
+                if (!writeChromeTrace(path)) {
+                    reportError("Can't write the trace " + path);
+                }
+            }
         }
+
+        TraceDump(const TraceDump &) = delete;
+
+        TraceDump &operator=(const TraceDump &) = delete;
+
+    private:
+        const std::string path;
     };
 
-    // My personal selection of ND filters
-    constexpr std::array<Filter, 4> filters = {
-        {
-            {10, "1k"}, // ND1000 = 10 stops
-            {6, "64"}, // ND64   = 6 stops
-            {3, "8"}, // ND8    = 3 stops
-            {2, "4"}, // ND4    = 2 stops
+    // Line reader on top of a file descriptor, the counterpart of std::getline for the REPL
+    class FdLineReader {
+    public:
+        explicit FdLineReader(const int initFd) : fd(initFd) {
         }
-    };
 
-    // Will hold various combinations of the filters
-    std::vector<Filter> combinedFilters;
+        bool readLine(std::string &line) {
+            while (true) {
+                if (const auto end = buffer.find('\n', scanned); end != std::string::npos) {
+                    line.assign(buffer, 0, end);
+                    buffer.erase(0, end + 1);
+                    scanned = 0;
+                    return true;
+                }
+                scanned = buffer.size();
 
-    // Shutter speeds supported by my Canon 90D but commented some extreme values I will not need
-    constexpr std::array<Shutter, 52> shutters = {
-        {
-            // Fraction-based shutter speeds, for example: 800 = 1/8000s
-            // Shutter(8000),
-            // Shutter(6400),
-            // Shutter(5000),
-            Shutter(4000),
-            Shutter(3200),
-            Shutter(2500),
-            Shutter(2000),
-            Shutter(1600),
-            Shutter(1250),
-            Shutter(1000),
-            Shutter(800),
-            Shutter(640),
-            Shutter(500),
-            Shutter(400),
-            Shutter(320),
-            Shutter(250),
-            Shutter(200),
-            Shutter(160),
-            Shutter(125),
-            Shutter(100),
-            Shutter(80),
-            Shutter(60),
-            Shutter(50),
-            Shutter(40),
-            Shutter(30),
-            Shutter(25),
-            Shutter(20),
-            Shutter(15),
-            Shutter(13),
-            Shutter(10),
-            Shutter(8),
-            Shutter(6),
-            Shutter(5), // 1/5 => 0.200s
-            Shutter(4), // 1/4 => 0.250s
-
-            // Decimal second based shutter speeds, for example 3"2 = 3.2s
-            Shutter(0, 3), //  0.3s
-            Shutter(0, 4), //  0.4s
-            Shutter(0, 5), //  0.5s
-            Shutter(0, 6), //  0.6s
-            Shutter(0, 8), //  0.8s
-            Shutter(1, 0), //  1.0s
-            Shutter(1, 3), //  1.3s
-            Shutter(1, 6), //  1.6s
-            Shutter(2, 0), //  2.0s
-            Shutter(2, 5), //  2.5s
-            Shutter(3, 2), //  3.2s
-            Shutter(4, 0), //  4.0s
-            Shutter(5, 0), //  5.0s
-            Shutter(6, 0), //  6.0s
-            Shutter(8, 0), //  8.0s
-            Shutter(10, 0), // 10.0s
-            Shutter(13, 0), // 13.0s
-            Shutter(15, 0), // 15.0s
-            Shutter(20, 0), // 20.0s
-            Shutter(25, 0), // 25.0s
-            Shutter(30, 0), // 30.0s
+                std::array<char, 4096> chunk;
+                const ssize_t result = ::read(fd, chunk.data(), chunk.size());
+                if (result < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (result <= 0) {
+                    // End of the input, the last line might be missing its new line
+                    line = std::move(buffer);
+                    buffer.clear();
+                    scanned = 0;
+                    return !line.empty();
+                }
+                buffer.append(chunk.data(), static_cast<std::size_t>(result));
+            }
         }
+
+    private:
+        const int fd;
+        std::string buffer;
+        std::size_t scanned = 0; // Part of the buffer already known to have no new line
     };
 
+    std::vector<Filter> combinedFilters;
+
+    // Bumped whenever a kit is published, cached answers from an older kit are then discarded
+    std::atomic<std::uint64_t> kitGeneration = 0;
+
     void populateFiltersWithHandPickedCombinations() {
         static_assert(filters.size() >= 4, "The hand picked combinations expect to have at least 4 filters");
 
@@ -217,78 +303,1607 @@ namespace shutter_calculator {
         std::sort(combinedFilters.begin(), combinedFilters.end());
     }
 
+    // Numeric models for applying stops to a shutter time. The stops are given in thirds, the finest step any
+    // camera or filter uses. Each model turns the stops into a multiplication factor and applies it to a shutter:
+    //  - IntegerStops:     today's 1 << stops, thirds are rounded down to whole stops
+    //  - FixedPointThirds: Q16 fixed-point powers of 2^(1/3)
+    //  - ExactRational:    whole fractions with the nominal third steps printed on cameras (x1.25, x1.6), the
+    //                      result is rounded only once, so cards are bit-exact between builds
+    //  - DoubleStops:      std::exp2, for calibrated and statistical work
+    template<typename Representation>
+    concept StopRepresentation = requires(const Shutter &shutter, const int thirds) {
+        typename Representation::Factor;
+        { Representation::name } -> std::convertible_to<std::string_view>;
+        { Representation::factor(thirds) } -> std::same_as<typename Representation::Factor>;
+        { Representation::duration(shutter, Representation::factor(thirds)) } -> std::same_as<double>;
+    };
+
+    struct IntegerStops {
+        using Factor = std::uint64_t;
+        static constexpr std::string_view name = "int";
+
+        static constexpr Factor factor(const int thirds) {
+            return Factor{1} << (thirds / 3);
+        }
+
+        static constexpr double duration(const Shutter &shutter, const Factor factor) {
+            return shutter.time * static_cast<double>(factor);
+        }
+    };
+
+    struct FixedPointThirds {
+        using Factor = std::uint64_t; // Q16
+        static constexpr std::string_view name = "fixed";
+
+        static constexpr Factor factor(const int thirds) {
+            // 2^0, 2^(1/3) and 2^(2/3) in Q16
+            constexpr std::array<Factor, 3> thirdSteps = {65536, 82570, 104032};
+            return thirdSteps[thirds % 3] << (thirds / 3);
+        }
+
+        static constexpr double duration(const Shutter &shutter, const Factor factor) {
+            return shutter.time * static_cast<double>(factor) / 65536.0;
+        }
+    };
+
+    struct ExactRational {
+        struct Factor {
+            std::uint64_t numerator;
+            std::uint64_t denominator;
+        };
+
+        static constexpr std::string_view name = "rational";
+
+        static constexpr Factor factor(const int thirds) {
+            constexpr std::array<Factor, 3> thirdSteps = {{{1, 1}, {5, 4}, {8, 5}}};
+            const auto [numerator, denominator] = thirdSteps[thirds % 3];
+            return {numerator << (thirds / 3), denominator};
+        }
+
+        static constexpr double duration(const Shutter &shutter, const Factor factor) {
+            return static_cast<double>(static_cast<std::uint64_t>(shutter.numerator) * factor.numerator) /
+                   static_cast<double>(static_cast<std::uint64_t>(shutter.denominator) * factor.denominator);
+        }
+    };
+
+    struct DoubleStops {
+        using Factor = double;
+        static constexpr std::string_view name = "double";
+
+        static Factor factor(const int thirds) {
+            return std::exp2(thirds / 3.0);
+        }
+
+        static constexpr double duration(const Shutter &shutter, const Factor factor) {
+            return shutter.time * factor;
+        }
+    };
+
+    template<StopRepresentation Representation>
+    ExposureGrid computeExposureGrid(const std::span<const Shutter> rows, const std::span<const int> thirdsColumns) {
+        // The factors only depend on the column, the inner loop is then a plain multiplication per cell
+        std::vector<typename Representation::Factor> factors;
+        factors.reserve(thirdsColumns.size());
+        for (const int thirds: thirdsColumns) {
+            factors.push_back(Representation::factor(thirds));
+        }
+
+        ExposureGrid grid{.columns = thirdsColumns.size(), .durations = {}};
+        grid.durations.reserve(rows.size() * thirdsColumns.size());
+        for (const auto &shutter: rows) {
+            for (const auto &factor: factors) {
+                grid.durations.push_back(Representation::duration(shutter, factor));
+            }
+        }
+        return grid;
+    }
+
+    // The grid of the shutters ladder against the combinedFilters
+    template<StopRepresentation Representation>
+    ExposureGrid computeFiltersGrid() {
+        std::vector<int> thirds;
+        thirds.reserve(combinedFilters.size());
+        for (const auto &filter: combinedFilters) {
+            thirds.push_back(filter.stops * 3);
+        }
+        return computeExposureGrid<Representation>(shutters, thirds);
+    }
+
+    using GridComputation = ExposureGrid (*)();
+
+    std::optional<GridComputation> gridComputationFor(const std::string_view arithmetic) {
+        if (arithmetic == IntegerStops::name) {
+            return &computeFiltersGrid<IntegerStops>;
+        }
+        if (arithmetic == FixedPointThirds::name) {
+            return &computeFiltersGrid<FixedPointThirds>;
+        }
+        if (arithmetic == ExactRational::name) {
+            return &computeFiltersGrid<ExactRational>;
+        }
+        if (arithmetic == DoubleStops::name) {
+            return &computeFiltersGrid<DoubleStops>;
+        }
+        return std::nullopt;
+    }
+
+    // Epoch based reclamation of the replaced snapshots. A reader announces the epoch it saw before loading the
+    // snapshot and clears it when done. A snapshot replaced when the epoch moved to E is freed once no reader still
+    // announces an epoch below E, such a reader could be the only one left holding it. Readers only do a few atomic
+    // loads and stores, they never wait for a writer.
+    std::atomic<const KitSnapshot *> currentKit = nullptr;
+    std::atomic<std::uint64_t> kitEpoch = 1;
+
+    struct KitReader {
+        std::atomic<std::uint64_t> epoch = 0; // 0 outside of a read
+        int depth = 0; // Reads nested on the same thread keep the outermost epoch
+    };
+
+    std::mutex kitReadersMutex; // Only taken by a thread's first read and by the writers
+    std::vector<std::unique_ptr<KitReader> > kitReaders;
+
+    KitReader &threadKitReader() {
+        thread_local KitReader &reader = [] -> KitReader & {
+            std::lock_guard lock(kitReadersMutex);
+            return *kitReaders.emplace_back(std::make_unique<KitReader>());
+        }();
+        return reader;
+    }
+
+    KitReadGuard::KitReadGuard() : reader(threadKitReader()) {
+        if (reader.depth++ == 0) {
+            // Sequentially consistent, the epoch has to be announced before the snapshot is loaded
+            reader.epoch.store(kitEpoch.load());
+        }
+        kit = currentKit.load();
+    }
+
+    KitReadGuard::~KitReadGuard() {
+        if (--reader.depth == 0) {
+            reader.epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    struct RetiredKit {
+        std::unique_ptr<const KitSnapshot> kit;
+        std::uint64_t epoch; // Started by the swap which replaced it
+    };
+
+    std::mutex kitWritersMutex;
+    std::vector<RetiredKit> retiredKits; // Guarded by kitWritersMutex
+
+    // Frees the replaced snapshots no reader can see anymore, returns how many are still pinned
+    std::size_t reclaimRetiredKits() {
+        std::lock_guard writersLock(kitWritersMutex);
+        std::uint64_t oldestReader = std::numeric_limits<std::uint64_t>::max();
+        {
+            std::lock_guard readersLock(kitReadersMutex);
+            for (const auto &reader: kitReaders) {
+                if (const std::uint64_t epoch = reader->epoch.load(); epoch != 0) {
+                    oldestReader = std::min(oldestReader, epoch);
+                }
+            }
+        }
+        std::erase_if(retiredKits, [oldestReader](const RetiredKit &retired) {
+            return retired.epoch <= oldestReader;
+        });
+        return retiredKits.size();
+    }
+
+    // Builds the snapshot of the given stacks and makes it the kit new queries see, returns its generation
+    std::uint64_t publishKit(std::vector<Filter> stacks) {
+        std::stable_sort(stacks.begin(), stacks.end()); // Keeps the order of an already sorted kit
+
+        std::vector<int> stops;
+        std::vector<int> thirds;
+        std::vector<int> prefixMinimalCounts;
+        for (const auto &stack: stacks) {
+            stops.push_back(stack.stops);
+            thirds.push_back(stack.stops * 3);
+            prefixMinimalCounts.push_back(std::min(stack.count, prefixMinimalCounts.empty()
+                                                                    ? stack.count
+                                                                    : prefixMinimalCounts.back()));
+        }
+        auto snapshot = std::make_unique<KitSnapshot>(KitSnapshot{
+            .stacks = std::move(stacks),
+            .stopsIndex = EytzingerIndex<int>(stops),
+            .prefixMinimalCounts = std::move(prefixMinimalCounts),
+            .grid = computeExposureGrid<IntegerStops>(shutters, thirds),
+            .generation = 0
+        });
+
+        std::uint64_t generation;
+        {
+            std::lock_guard lock(kitWritersMutex);
+            generation = kitGeneration.fetch_add(1, std::memory_order_acq_rel) + 1;
+            snapshot->generation = generation;
+            if (const KitSnapshot *previous = currentKit.exchange(snapshot.release())) {
+                retiredKits.push_back({.kit = std::unique_ptr<const KitSnapshot>(previous),
+                    .epoch = kitEpoch.fetch_add(1) + 1});
+            }
+        }
+        reclaimRetiredKits();
+        return generation;
+    }
+
+    // Times each model on a large grid in third stops and reports its worst relative error against 2^(thirds/3),
+    // so the fastest model still precise enough for a given output can be picked
+    void benchmarkArithmetic() {
+        std::vector<int> thirds(3000);
+        for (std::size_t i = 0; i < thirds.size(); i++) {
+            thirds[i] = static_cast<int>(i % 61); // Up to 20 stops, beyond ND1000 + ND64 + ND8 + ND4
+        }
+
+        const auto reference = computeExposureGrid<DoubleStops>(shutters, thirds);
+        constexpr int repetitions = 50;
+
+        standardOutput << "| model    | ns/cell | max rel. error |\n";
+        standardOutput << "| -------- | ------- | -------------- |\n";
+
+        const auto measure = [&]<StopRepresentation Representation>() {
+            ExposureGrid grid;
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repetitions; i++) {
+                grid = computeExposureGrid<Representation>(shutters, thirds);
+            }
+            const double nanoseconds = std::chrono::duration<double, std::nano>(
+                                           std::chrono::steady_clock::now() - start).count() /
+                                       (repetitions * static_cast<double>(grid.durations.size()));
+
+            double maximalError = 0.0;
+            for (std::size_t i = 0; i < grid.durations.size(); i++) {
+                maximalError = std::max(maximalError,
+                                        std::abs(grid.durations[i] / reference.durations[i] - 1.0));
+            }
+
+            standardOutput << std::format("| {:8} | {:7.2f} | {:14.2e} |\n", Representation::name, nanoseconds,
+                                          maximalError);
+        };
+
+        measure.operator()<IntegerStops>();
+        measure.operator()<FixedPointThirds>();
+        measure.operator()<ExactRational>();
+        measure.operator()<DoubleStops>();
+    }
+
     void displayMarkdownTableHeader() {
-        std::cout << "| no ND   | ";
+        standardOutput << "| no ND   | ";
         for (const auto &filter: combinedFilters) {
-            std::cout << filter.toString() << " | ";
+            standardOutput << filter.toString() << " | ";
         }
-        std::cout << std::endl;
+        standardOutput << '\n';
 
-        std::cout << "| ------- | ";
+        standardOutput << "| ------- | ";
         for (int i = 0; i < combinedFilters.size(); i++) {
-            std::cout << "------- | ";
+            standardOutput << "------- | ";
         }
-        std::cout << std::endl;
+        standardOutput << '\n';
     }
 
-    void displayMarkdownTable() {
+    // Huge tables (thousands of stacks) are formatted in blocks of rows on the worker pool, each block into its own
+    // buffer. Blocks are written in order as soon as they and all the ones before them are done, the finished run
+    // with a single writev(2), so output starts with the first block and the same bytes as row after row come out.
+    // Small tables stay on the calling thread, handing them to the pool would cost more than formatting them.
+    std::size_t renderThreads = std::max(1u, std::thread::hardware_concurrency());
+    constexpr std::size_t parallelRenderMinimalCells = 1 << 16;
+
+    template<typename AppendRow>
+    void renderRowBlocks(const std::size_t rows, const std::size_t cells, const AppendRow &appendRow) {
+        const std::size_t blocksCount = cells < parallelRenderMinimalCells ? 1 : std::min(renderThreads, rows);
+        if (blocksCount <= 1) {
+            std::string text;
+            for (std::size_t row = 0; row < rows; row++) {
+                appendRow(text, row);
+            }
+            standardOutput << text;
+            return;
+        }
+
+        std::vector<std::future<std::string> > inFlight;
+        for (std::size_t block = 0; block < blocksCount; block++) {
+            inFlight.push_back(workerPool.submit([&appendRow, rows, blocksCount, block] {
+                const ScopedTrace trace("format rows", static_cast<std::int64_t>(block));
+                std::string text;
+                for (std::size_t row = rows * block / blocksCount; row < rows * (block + 1) / blocksCount; row++) {
+                    appendRow(text, row);
+                }
+                return text;
+            }));
+        }
+
+        std::vector<std::string> ready;
+        for (std::size_t next = 0; next < blocksCount;) {
+            ready.clear();
+            ready.push_back(inFlight[next++].get());
+            while (next < blocksCount &&
+                   inFlight[next].wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                ready.push_back(inFlight[next++].get());
+            }
+            standardOutput.writeBlocks(ready);
+        }
+    }
+
+    template<typename Style>
+    void displayMarkdownTable(const ExposureGrid &grid) {
         displayMarkdownTableHeader();
 
-        for (const auto &shutter: shutters) {
-            std::cout << "| " << shutter.toString() << " | ";
+        renderRowBlocks(shutters.size(), grid.durations.size(), [&grid](std::string &text, const std::size_t row) {
+            text += "| ";
+            text += shutters[row].toString<Style>();
+            text += " | ";
 
             // For each shutter speed show all filter combinations
-            for (const auto &[stops, _]: combinedFilters) {
-                std::cout << shutter.toStringWithFilterStops(stops) << " | ";
+            for (std::size_t column = 0; column < grid.columns; column++) {
+                text += formatDuration<Style>(grid.at(row, column));
+                text += " | ";
             }
 
-            std::cout << std::endl;
-        }
+            text += '\n';
+        });
     }
 
-    void displayCsvHeader() {
-        std::cout << std::endl;
-
-        std::cout << "  no ND";
+    std::string csvHeader() {
+        std::string text = "\n  no ND";
         for (const auto &filter: combinedFilters) {
-            std::cout << ",  " << filter.toString();
+            text += ",  ";
+            text += filter.toString();
         }
-        std::cout << std::endl;
+        text += '\n';
+        return text;
     }
 
-    void displayCsvRow(const Shutter shutter) {
-        std::cout << shutter.toString();
+    template<typename Style>
+    void appendCsvRow(std::string &text, const ExposureGrid &grid, const std::size_t row) {
+        text += shutters[row].toString<Style>();
 
         // For a specific shutter speed, show all filter combinations
-        for (const auto &[stops, _]: combinedFilters) {
-            std::cout << ",  " << shutter.toStringWithFilterStops(stops);
+        for (std::size_t column = 0; column < grid.columns; column++) {
+            text += ",  ";
+            text += formatDuration<Style>(grid.at(row, column));
         }
 
-        std::cout << std::endl;
+        text += '\n';
     }
 
-    void displayCsvTable() {
-        constexpr int shuttersCount = static_cast<int>(shutters.size());
-        constexpr int middle = shuttersCount / 2;
+    template<typename Style>
+    void displayCsvTable(const ExposureGrid &grid) {
+        constexpr std::size_t middle = shutters.size() / 2;
+        const std::string header = csvHeader();
 
-        for (int i = 0; i < shuttersCount; i++) {
-            if ((i % middle) == 0) {
+        renderRowBlocks(shutters.size(), grid.durations.size(), [&](std::string &text, const std::size_t row) {
+            if ((row % middle) == 0) {
                 // this will trigger header twice, in begining and in middle of the table
-                displayCsvHeader();
+                text += header;
+            }
+
+            appendCsvRow<Style>(text, grid, row);
+        });
+    }
+
+    template<typename Style>
+    void displayTables(const ExposureGrid &grid) {
+        displayMarkdownTable<Style>(grid);
+        displayCsvTable<Style>(grid);
+    }
+
+    // The style is picked once per run, the whole table rendering is then specialized for it
+    using TablesRenderer = void (*)(const ExposureGrid &grid);
+
+    std::optional<TablesRenderer> tablesRendererForStyle(const std::string_view style) {
+        if (style == "canon") {
+            return &displayTables<Canon90dStyle>;
+        }
+        if (style == "precise") {
+            return &displayTables<PreciseStyle>;
+        }
+        if (style == "unlimited") {
+            return &displayTables<UnlimitedBulbStyle>;
+        }
+        return std::nullopt;
+    }
+
+    // Renders the tables for a synthetic catalog of stacks with more and more threads, the kit is replaced for the
+    // rest of the run. The tables go to /dev/null, their size is measured once through a temporary file.
+    int benchmarkRender(const std::size_t stacksCount) {
+        combinedFilters.clear();
+        for (std::size_t i = 0; i < stacksCount; i++) {
+            combinedFilters.push_back({.stops = static_cast<int>(i % 20), .name = std::format("s{}", i % 100000)});
+        }
+        sortFilters();
+        const ExposureGrid grid = computeFiltersGrid<IntegerStops>();
+
+        // The measured output goes to the standard output, which is pointed at the file being measured
+        const int savedOutput = dup(STDOUT_FILENO);
+        const auto renderInto = [&](const int file) {
+            standardOutput.flush();
+            dup2(file, STDOUT_FILENO);
+            const auto start = std::chrono::steady_clock::now();
+            displayTables<Canon90dStyle>(grid);
+            standardOutput.flush();
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            dup2(savedOutput, STDOUT_FILENO);
+            return elapsed.count();
+        };
+
+        std::string sizePath = "/tmp/shutterCalculatorRenderXXXXXX";
+        const int sizeFile = mkstemp(sizePath.data());
+        const int nullFile = open("/dev/null", O_WRONLY);
+        if (savedOutput < 0 || sizeFile < 0 || nullFile < 0) {
+            reportError("Can't redirect the output of the benchmark");
+            return 1;
+        }
+        unlink(sizePath.c_str());
+        renderInto(sizeFile);
+        const auto bytes = static_cast<double>(lseek(sizeFile, 0, SEEK_CUR));
+        ::close(sizeFile);
+
+        const std::size_t maximalThreads = renderThreads;
+        standardOutput << std::format("{} stacks, {:.1f} MB of tables\n", stacksCount, bytes / 1e6);
+        standardOutput << "| threads | seconds | MB/s    | speedup |\n";
+        standardOutput << "| ------- | ------- | ------- | ------- |\n";
+        double serialSeconds = 0.0;
+        for (std::size_t threads = 1; threads <= maximalThreads; threads = threads < maximalThreads
+                                                                           ? std::min(threads * 2, maximalThreads)
+                                                                           : threads + 1) {
+            renderThreads = threads;
+            const double seconds = renderInto(nullFile);
+            serialSeconds = threads == 1 ? seconds : serialSeconds;
+            standardOutput << std::format("| {:7} | {:7.3f} | {:7.0f} | {:7.2f} |\n", threads, seconds,
+                                          bytes / seconds / 1e6, serialSeconds / seconds);
+        }
+        ::close(nullFile);
+        ::close(savedOutput);
+        return 0;
+    }
+
+    // Compares the batched Eytzinger search against std::lower_bound on synthetic catalogs of stacks, the stops are
+    // kept as tenths of a stop so large catalogs are not just long runs of duplicates
+    void benchmarkSearch() {
+        constexpr std::size_t queriesCount = 1 << 20;
+        std::mt19937 generator(42);
+
+        standardOutput << "| stacks   | lower_bound | eytzinger batch |" << '\n';
+        standardOutput << "| -------- | ----------- | --------------- |" << '\n';
+
+        for (std::size_t stacks = 10; stacks <= 10'000'000; stacks *= 10) {
+            std::uniform_int_distribution<int> stopsDistribution(0, static_cast<int>(stacks) * 4);
+            std::vector<int> sorted(stacks);
+            for (auto &stops: sorted) {
+                stops = stopsDistribution(generator);
+            }
+            std::sort(sorted.begin(), sorted.end());
+
+            std::vector<int> queries(queriesCount);
+            for (auto &query: queries) {
+                query = stopsDistribution(generator);
+            }
+
+            const EytzingerIndex<int> index(sorted);
+            std::vector<std::size_t> expected(queriesCount);
+            std::vector<std::size_t> results(queriesCount);
+
+            const auto timeNs = [](const auto &function) {
+                const auto start = std::chrono::steady_clock::now();
+                function();
+                const auto end = std::chrono::steady_clock::now();
+                return std::chrono::duration<double, std::nano>(end - start).count() / queriesCount;
+            };
+
+            const double lowerBoundNs = timeNs([&] {
+                for (std::size_t i = 0; i < queriesCount; i++) {
+                    expected[i] = std::lower_bound(sorted.begin(), sorted.end(), queries[i]) - sorted.begin();
+                }
+            });
+
+            const double batchNs = timeNs([&] {
+                index.lowerBoundBatch(queries, results);
+            });
+
+            if (results != expected) {
+                reportError(std::format("Eytzinger search disagrees with std::lower_bound for {} stacks", stacks));
+            }
+
+            standardOutput << std::format("| {:8} | {:8.1f} ns | {:12.1f} ns |", stacks, lowerBoundNs, batchNs)
+                    << '\n';
+        }
+    }
+
+    // The stacks are sorted by stops, so the Pareto front is found by walking outwards from the target, in order
+    // of increasing error, and keeping only stacks which need fewer filters than anything closer to the target.
+    // Finding the target is O(log n) and the walk ends once it reached the fewest filters of any eligible
+    // stack, usually after a few groups; it only degrades to O(n) when that stack is far from the target.
+    std::vector<ParetoStack> paretoStacks(const KitSnapshot &kit, const Shutter base, const double targetSeconds,
+                                          const int maxFilters) {
+        const auto &stacks = kit.stacks;
+        std::vector<ParetoStack> front;
+        if (stacks.empty() || targetSeconds <= 0.0) {
+            return front;
+        }
+
+        // The stacks past the BULB limit are all at the end and never eligible, the walk stays below them. The
+        // bound has one stop to spare against rounding, the exact check is done on each stack.
+        const int bulbStops = static_cast<int>(std::ceil(std::log2(bulbLimitSeconds / base.time))) + 1;
+        const auto end = stacks.begin() + static_cast<std::ptrdiff_t>(kit.stopsIndex.lowerBound(bulbStops));
+        if (end == stacks.begin()) {
+            return front;
+        }
+        const int minimalCount = kit.prefixMinimalCounts[static_cast<std::size_t>(end - stacks.begin()) - 1];
+        if (minimalCount > maxFilters) {
+            return front;
+        }
+
+        const double targetStops = std::log2(targetSeconds / base.time);
+        const auto errorOf = [targetStops](const Filter &filter) {
+            return filter.stops - targetStops;
+        };
+
+        // hi is the first stack at or above the target, lo walks down from the last stack below the target
+        auto hi = std::min(end, stacks.begin() + static_cast<std::ptrdiff_t>(
+                               kit.stopsIndex.lowerBound(static_cast<int>(std::ceil(targetStops)))));
+        auto lo = hi;
+
+        int bestCount = std::numeric_limits<int>::max();
+        while (bestCount > minimalCount && (lo != stacks.begin() || hi != end)) {
+            // The next group is every stack at the nearest remaining distance from the target, from both sides when
+            // they are equally far. Within a group only the fewest filters are worth it, and only when they beat
+            // every closer stack on the count.
+            constexpr double none = std::numeric_limits<double>::infinity();
+            const double lowDistance = lo != stacks.begin() ? -errorOf(*(lo - 1)) : none;
+            const double highDistance = hi != end ? errorOf(*hi) : none;
+            const auto groupLo = lo;
+            const auto groupHi = hi;
+            if (lowDistance <= highDistance) {
+                const int stops = (lo - 1)->stops;
+                while (lo != stacks.begin() && (lo - 1)->stops == stops) {
+                    --lo;
+                }
+            }
+            if (highDistance <= lowDistance) {
+                const int stops = hi->stops;
+                while (hi != end && hi->stops == stops) {
+                    ++hi;
+                }
+            }
+
+            const auto eligible = [&](const Filter &filter) {
+                return filter.count < bestCount && filter.count <= maxFilters &&
+                       base.timeWithFilterStops(filter.stops) < bulbLimitSeconds;
+            };
+            int groupCount = bestCount;
+            for (auto filter = lo; filter != groupLo; ++filter) {
+                groupCount = eligible(*filter) ? std::min(groupCount, filter->count) : groupCount;
+            }
+            for (auto filter = groupHi; filter != hi; ++filter) {
+                groupCount = eligible(*filter) ? std::min(groupCount, filter->count) : groupCount;
+            }
+
+            const auto keep = [&](const Filter &filter) {
+                if (filter.count == groupCount && eligible(filter)) {
+                    front.push_back({
+                        .filter = &filter, .duration = base.timeWithFilterStops(filter.stops),
+                        .errorStops = errorOf(filter)
+                    });
+                }
+            };
+            for (auto filter = groupLo; filter != lo;) {
+                keep(*--filter);
+            }
+            for (auto filter = groupHi; filter != hi; ++filter) {
+                keep(*filter);
+            }
+            bestCount = groupCount;
+        }
+
+        return front;
+    }
+
+    // Every query starts here, the labels are formatted once and sorted so a lookup is a binary search
+    const Shutter *findShutter(const std::string_view label) {
+        static const auto labels = [] {
+            std::vector<std::pair<std::string, const Shutter *> > sorted;
+            for (const auto &shutter: shutters) {
+                const std::string text = shutter.toString();
+                sorted.emplace_back(text.substr(std::min(text.find_first_not_of(' '), text.size())), &shutter);
+            }
+            std::ranges::sort(sorted);
+            return sorted;
+        }();
+
+        const auto found = std::ranges::lower_bound(labels, label, {}, [](const auto &entry) {
+            return std::string_view(entry.first);
+        });
+        return found != labels.end() && found->first == label ? found->second : nullptr;
+    }
+
+    std::string formatParetoStacks(const std::vector<ParetoStack> &front) {
+        std::string text = "| filters | time    | error   |\n"
+                           "| ------- | ------- | ------- |\n";
+
+        for (const auto &[filter, duration, errorStops]: front) {
+            text += std::format("| {} | {} | {:7.2f} |\n",
+                                filter->toString(), Shutter::durationToString(duration), errorStops);
+        }
+        return text;
+    }
+
+    std::string renderParetoStacks(const Shutter base, const double targetSeconds,
+                                   const int maxFilters = std::numeric_limits<int>::max()) {
+        const KitReadGuard kit;
+        return formatParetoStacks(paretoStacks(*kit, base, targetSeconds, maxFilters));
+    }
+
+    void displayParetoStacks(const Shutter base, const double targetSeconds) {
+        standardOutput << renderParetoStacks(base, targetSeconds);
+    }
+
+    // Log-bucketed latency histogram in the spirit of HDR histograms: values below 8ns get their own bucket, above
+    // that every power of two is split into 8 sub-buckets, which keeps the relative error under 12.5% across the
+    // whole 64-bit range with less than 500 counters. Only the owning thread writes, so recording is a plain
+    // relaxed load and store without any read-modify-write.
+    class LatencyHistogram {
+    public:
+        static constexpr std::size_t subBuckets = 8;
+        static constexpr std::size_t bucketsCount = (64 - 2) * subBuckets;
+
+        using Counts = std::array<std::uint64_t, bucketsCount>;
+
+        void record(const std::uint64_t nanoseconds) {
+            auto &bucket = buckets[bucketOf(nanoseconds)];
+            bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        void addTo(Counts &counts) const {
+            for (std::size_t i = 0; i < bucketsCount; i++) {
+                counts[i] += buckets[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        static constexpr std::size_t bucketOf(const std::uint64_t value) {
+            if (value < subBuckets) {
+                return value;
+            }
+            const int exponent = std::bit_width(value) - 4;
+            return exponent * subBuckets + (value >> exponent);
+        }
+
+        // Smallest value which lands in the bucket
+        static constexpr std::uint64_t valueOf(const std::size_t bucket) {
+            if (bucket < subBuckets) {
+                return bucket;
+            }
+            const std::size_t exponent = bucket / subBuckets - 1;
+            return (bucket % subBuckets + subBuckets) << exponent;
+        }
+
+    private:
+        std::array<std::atomic<std::uint64_t>, bucketsCount> buckets{};
+    };
+
+    static_assert(LatencyHistogram::bucketOf(std::numeric_limits<std::uint64_t>::max()) <
+                  LatencyHistogram::bucketsCount);
+
+    // Query types and the stages of their pipeline which get their own histogram
+    enum class Metric : std::size_t {
+        ParetoQueryHit,
+        ParetoQueryMiss,
+        CacheLookup,
+        ParetoCompute,
+        ParetoFormat,
+        Count
+    };
+
+    constexpr std::array<std::string_view, static_cast<std::size_t>(Metric::Count)> metricNames = {
+        "query.pareto.hit",
+        "query.pareto.miss",
+        "stage.cache_lookup",
+        "stage.pareto_compute",
+        "stage.pareto_format",
+    };
+
+    using ThreadHistograms = std::array<LatencyHistogram, static_cast<std::size_t>(Metric::Count)>;
+
+    // Every thread records into its own histograms, which stay registered after the thread exits so no samples
+    // are lost, and readers merge all of them
+    std::mutex histogramsRegistryMutex;
+    std::vector<std::unique_ptr<ThreadHistograms> > histogramsRegistry;
+
+    ThreadHistograms &threadHistograms() {
+        thread_local ThreadHistograms &histograms = [] -> ThreadHistograms & {
+            std::lock_guard lock(histogramsRegistryMutex);
+            return *histogramsRegistry.emplace_back(std::make_unique<ThreadHistograms>());
+        }();
+        return histograms;
+    }
+
+    void recordLatency(const Metric metric, const std::uint64_t nanoseconds) {
+        threadHistograms()[static_cast<std::size_t>(metric)].record(nanoseconds);
+    }
+
+    LatencyHistogram::Counts mergedLatencies(const Metric metric) {
+        LatencyHistogram::Counts counts{};
+        std::lock_guard lock(histogramsRegistryMutex);
+        for (const auto &histograms: histogramsRegistry) {
+            (*histograms)[static_cast<std::size_t>(metric)].addTo(counts);
+        }
+        return counts;
+    }
+
+    // Lower bound of the bucket holding the given quantile
+    std::uint64_t latencyQuantile(const LatencyHistogram::Counts &counts, const double quantile) {
+        std::uint64_t total = 0;
+        for (const auto count: counts) {
+            total += count;
+        }
+
+        const auto rank = static_cast<std::uint64_t>(std::ceil(quantile * static_cast<double>(total)));
+        std::uint64_t seen = 0;
+        for (std::size_t bucket = 0; bucket < counts.size(); bucket++) {
+            seen += counts[bucket];
+            if (seen >= std::max<std::uint64_t>(rank, 1)) {
+                return LatencyHistogram::valueOf(bucket);
+            }
+        }
+        return 0;
+    }
+
+    // Times consecutive stages of one query. The end of a stage is the start of the next one and the query total
+    // reuses the last one, so a query with n stages reads the clock n + 1 times instead of twice per histogram.
+    class LatencyLaps {
+    public:
+        LatencyLaps() : start(std::chrono::steady_clock::now()), last(start) {
+        }
+
+        // Records the time since the previous lap (or the start) as the given stage
+        void lap(const Metric metric) {
+            const auto now = std::chrono::steady_clock::now();
+            recordLatency(metric, nanosecondsBetween(last, now));
+            last = now;
+        }
+
+        // Records the time from the start to the last lap, or to now when work happened after it
+        void total(const Metric metric, const bool sinceLastLap = true) {
+            recordLatency(metric, nanosecondsBetween(start, sinceLastLap ? last : std::chrono::steady_clock::now()));
+        }
+
+    private:
+        const std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point last;
+
+        static std::uint64_t nanosecondsBetween(const std::chrono::steady_clock::time_point from,
+                                                const std::chrono::steady_clock::time_point to) {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+        }
+    };
+
+    // Plain text dump, one line per metric with the sample count and the percentiles in nanoseconds
+    std::string renderMetrics() {
+        std::string text;
+        for (std::size_t i = 0; i < metricNames.size(); i++) {
+            const auto counts = mergedLatencies(static_cast<Metric>(i));
+            std::uint64_t total = 0;
+            for (const auto count: counts) {
+                total += count;
+            }
+
+            text += std::format("{} count={} p50={} p90={} p99={} p999={} max={}\n", metricNames[i], total,
+                                latencyQuantile(counts, 0.5), latencyQuantile(counts, 0.9),
+                                latencyQuantile(counts, 0.99), latencyQuantile(counts, 0.999),
+                                latencyQuantile(counts, 1.0));
+        }
+        return text;
+    }
+
+    // Dumps the metrics to stderr on SIGUSR1. The signal is blocked in every thread and consumed by a dedicated
+    // thread with sigwait(), so the dump can format and allocate freely instead of running in a signal handler.
+    // Must be called before any other thread is started, so they inherit the blocked signal mask.
+    void startMetricsSignalThread() {
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+        std::thread([signals] {
+            int signal = 0;
+            while (sigwait(&signals, &signal) == 0) {
+                FdWriter error(STDERR_FILENO);
+                error << renderMetrics();
+            }
+        }).detach();
+    }
+
+    // Cost of the instrumentation itself: a clock read, a histogram record and a lap, which is what every stage
+    // pays on top of its own work
+    void benchmarkMetrics() {
+        constexpr std::size_t iterations = 1 << 24;
+
+        const auto timeNs = [](const auto &function) {
+            const auto start = std::chrono::steady_clock::now();
+            for (std::size_t i = 0; i < iterations; i++) {
+                function(i);
+            }
+            const auto end = std::chrono::steady_clock::now();
+            return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+        };
+
+        const double clockNs = timeNs([](std::size_t) {
+            [[maybe_unused]] const auto now = std::chrono::steady_clock::now();
+        });
+        const double recordNs = timeNs([](const std::size_t i) {
+            recordLatency(Metric::CacheLookup, i & 0xFFFF);
+        });
+        LatencyLaps laps;
+        const double lapNs = timeNs([&laps](std::size_t) {
+            laps.lap(Metric::CacheLookup);
+        });
+
+        standardOutput << "| operation           | per call |" << '\n';
+        standardOutput << "| ------------------- | -------- |" << '\n';
+        standardOutput << std::format("| steady_clock::now() | {:5.1f} ns |", clockNs) << '\n';
+        standardOutput << std::format("| recordLatency()     | {:5.1f} ns |", recordNs) << '\n';
+        standardOutput << std::format("| LatencyLaps::lap()  | {:5.1f} ns |", lapNs) << '\n';
+    }
+
+    std::uint64_t hashFields(const std::initializer_list<std::uint64_t> fields) {
+        std::uint64_t hash = 0;
+        for (const std::uint64_t field: fields) {
+            hash = hash * 0x9E3779B97F4A7C15ull ^ field;
+        }
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+        return hash ^ (hash >> 31);
+    }
+
+    struct ParetoQueryHash {
+        std::size_t operator()(const ParetoQuery &query) const {
+            return hashFields({
+                query.shutterIndex, static_cast<std::uint64_t>(query.targetMilliseconds),
+                static_cast<std::uint32_t>(query.maxFilters)
+            });
+        }
+    };
+
+    // Answers are shared, a hit only bumps a reference count under the shard lock instead of copying the text
+    using ParetoAnswer = std::shared_ptr<const std::string>;
+
+    ShardedLruCache<ParetoQuery, ParetoAnswer, ParetoQueryHash> paretoCache(4096);
+
+    ParetoAnswer answerParetoQuery(const ParetoQuery &query) {
+        const ScopedTrace trace("pareto query");
+        LatencyLaps laps;
+
+        // The answer is computed and cached for the kit pinned here, even if another one is published meanwhile
+        const KitReadGuard kit;
+        const std::uint64_t generation = kit->generation;
+        std::optional<ParetoAnswer> cached = paretoCache.find(query, generation);
+        laps.lap(Metric::CacheLookup);
+        if (cached) {
+            laps.total(Metric::ParetoQueryHit);
+            return std::move(*cached);
+        }
+
+        const auto front = paretoStacks(*kit, shutters[query.shutterIndex], query.targetSeconds(), query.maxFilters);
+        laps.lap(Metric::ParetoCompute);
+        ParetoAnswer text = std::make_shared<const std::string>(formatParetoStacks(front));
+        laps.lap(Metric::ParetoFormat);
+
+        paretoCache.insert(query, text, generation);
+        laps.total(Metric::ParetoQueryMiss, false);
+        return text;
+    }
+
+    std::string renderCacheStats() {
+        const std::uint64_t hits = paretoCache.hitsCount();
+        const std::uint64_t misses = paretoCache.missesCount();
+        const std::uint64_t total = hits + misses;
+
+        return std::format("cache hits {} misses {} hit rate {:.1f}% median hit {} ns median miss {} ns\n",
+                           hits, misses, total == 0 ? 0.0 : 100.0 * static_cast<double>(hits) / total,
+                           latencyQuantile(mergedLatencies(Metric::ParetoQueryHit), 0.5),
+                           latencyQuantile(mergedLatencies(Metric::ParetoQueryMiss), 0.5));
+    }
+
+    std::vector<std::string_view> splitWords(const std::string_view line) {
+        std::vector<std::string_view> words;
+        std::size_t position = 0;
+        while ((position = line.find_first_not_of(" \t\r", position)) != std::string_view::npos) {
+            const std::size_t end = std::min(line.find_first_of(" \t\r", position), line.size());
+            words.push_back(line.substr(position, end - position));
+            position = end;
+        }
+        return words;
+    }
+
+    // from_chars takes "inf" and "nan" too, the target has to be a real duration the stop arithmetic can handle
+    bool parseTargetSeconds(const std::string_view text, double &seconds) {
+        return parseNumber(text, seconds) && std::isfinite(seconds) &&
+               seconds * 1000.0 >= static_cast<double>(ParetoQuery::minimalTargetMilliseconds) &&
+               seconds * 1000.0 <= static_cast<double>(ParetoQuery::maximalTargetMilliseconds);
+    }
+
+    // Parses "<shutter> <target seconds> [max filters]" into a normalized query
+    std::optional<ParetoQuery> parseParetoQuery(const std::span<const std::string_view> words) {
+        const Shutter *base = words.size() >= 2 ? findShutter(words[0]) : nullptr;
+        double targetSeconds = 0.0;
+        int maxFilters = std::numeric_limits<int>::max();
+
+        if (base == nullptr || words.size() > 3 || !parseTargetSeconds(words[1], targetSeconds) ||
+            (words.size() == 3 && (!parseNumber(words[2], maxFilters) || maxFilters < 1))) {
+            return std::nullopt;
+        }
+
+        return ParetoQuery{
+            .shutterIndex = static_cast<std::size_t>(base - shutters.data()),
+            .targetMilliseconds = std::llround(targetSeconds * 1000.0),
+            .maxFilters = maxFilters
+        };
+    }
+
+    // Round trips the current table through the compact form, checks every header and cell against the live
+    // table and reports the size and the decoding throughput
+    int checkCompactTable() {
+        const auto bytes = encodeCompactTable(filters, combinedFilters, shutters);
+        if (!bytes) {
+            reportError("The table can't be stored in the compact form");
+            return 1;
+        }
+
+        const auto table = decodeCompactTable(*bytes);
+        if (!table || table->ladder.size() != shutters.size() || table->columns() != combinedFilters.size()) {
+            reportError("The compact form doesn't decode back into the same table");
+            return 1;
+        }
+
+        std::size_t mismatches = 0;
+        for (std::size_t column = 0; column < table->columns(); column++) {
+            const Filter stack = table->stack(column);
+            mismatches += stack.name != combinedFilters[column].name || stack.stops != combinedFilters[column].stops;
+        }
+        for (std::size_t row = 0; row < shutters.size(); row++) {
+            mismatches += table->ladder[row].toString() != shutters[row].toString();
+            for (std::size_t column = 0; column < table->columns(); column++) {
+                mismatches += table->cellText(row, column) !=
+                        shutters[row].toStringWithFilterStops(combinedFilters[column].stops);
+            }
+        }
+
+        // Decoding alone, and decoding with every cell formatted back to text
+        constexpr int repetitions = 2000;
+        std::size_t checksum = 0;
+        const auto decodeStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < repetitions; i++) {
+            checksum += decodeCompactTable(*bytes)->stackStops.size();
+        }
+        const auto formatStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < repetitions / 10; i++) {
+            const auto decoded = decodeCompactTable(*bytes);
+            for (std::size_t row = 0; row < decoded->ladder.size(); row++) {
+                for (std::size_t column = 0; column < decoded->columns(); column++) {
+                    checksum += decoded->cellText(row, column).size();
+                }
+            }
+        }
+        const auto end = std::chrono::steady_clock::now();
+
+        const double cells = static_cast<double>(shutters.size() * combinedFilters.size());
+        const double decodeSeconds = std::chrono::duration<double>(formatStart - decodeStart).count();
+        const double formatSeconds = std::chrono::duration<double>(end - formatStart).count();
+
+        standardOutput << std::format("{} bytes for {} cells, {:.2f} bytes/cell\n", bytes->size(),
+                                      static_cast<std::size_t>(cells), static_cast<double>(bytes->size()) / cells);
+        standardOutput << std::format("decode {:.1f} M cells/s, decode and format {:.1f} M cells/s\n",
+                                      cells * repetitions / decodeSeconds / 1e6,
+                                      cells * (repetitions / 10) / formatSeconds / 1e6);
+        standardOutput << std::format("round trip mismatches {} (checksum {})\n", mismatches, checksum);
+        return mismatches == 0 ? 0 : 2;
+    }
+
+    // FNV-1a, only used to notice when a replayed query answers differently than when it was captured
+    std::uint64_t hashText(const std::string_view text) {
+        std::uint64_t hash = 0xCBF29CE484222325ull;
+        for (const char character: text) {
+            hash = (hash ^ static_cast<unsigned char>(character)) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    // One captured query. On disk each record is a set of LEB128 varints (time delta from the previous record,
+    // shutter as its exact fraction, target, filter limit) followed by the 8 byte result hash, which is usually
+    // 15-17 bytes. The shutter is stored by value so a capture replays against any build of the ladder.
+    struct CapturedQuery {
+        std::uint64_t timestampNs; // Since the capture started
+        ParetoQuery query;
+        std::uint64_t resultHash;
+    };
+
+    constexpr std::string_view captureMagic = "SCTRACE2";
+
+    class QueryCapture {
+    public:
+        explicit QueryCapture(const std::string &path) : file(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)),
+                                                         start(std::chrono::steady_clock::now()) {
+            opened = file >= 0 && writeAll(file, captureMagic);
+        }
+
+        ~QueryCapture() {
+            if (file >= 0) {
+                ::close(file);
+            }
+        }
+
+        QueryCapture(const QueryCapture &) = delete;
+
+        QueryCapture &operator=(const QueryCapture &) = delete;
+
+        [[nodiscard]] bool isOpen() const {
+            return opened;
+        }
+
+        void record(const ParetoQuery &query, const std::string_view result) {
+            const auto timestampNs = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+
+            std::string bytes;
+            appendVarint(bytes, timestampNs - previousNs);
+            appendVarint(bytes, static_cast<std::uint64_t>(shutters[query.shutterIndex].numerator));
+            appendVarint(bytes, static_cast<std::uint64_t>(shutters[query.shutterIndex].denominator));
+            appendVarint(bytes, static_cast<std::uint64_t>(query.targetMilliseconds));
+            // The limit is at least 1, 0 stands for no limit
+            appendVarint(bytes, query.maxFilters == std::numeric_limits<int>::max()
+                                    ? 0
+                                    : static_cast<std::uint64_t>(query.maxFilters));
+
+            const std::uint64_t hash = hashText(result);
+            for (int i = 0; i < 8; i++) {
+                bytes.push_back(static_cast<char>(hash >> (8 * i)));
+            }
+
+            // A write(2) per record, the REPL can be killed at any time and the trace stays usable up to the last query
+            writeAll(file, bytes);
+            previousNs = timestampNs;
+        }
+
+    private:
+        const int file;
+        const std::chrono::steady_clock::time_point start;
+        bool opened = false;
+        std::uint64_t previousNs = 0;
+    };
+
+    // Queries on a shutter this build's ladder doesn't have are counted in skipped
+    std::optional<std::vector<CapturedQuery> > loadCapture(const std::string &path, std::size_t &skipped) {
+        const std::string bytes = readFile(path).value_or("");
+        if (!bytes.starts_with(captureMagic)) {
+            return std::nullopt;
+        }
+
+        std::size_t position = captureMagic.size();
+        std::vector<CapturedQuery> queries;
+        std::uint64_t timestampNs = 0;
+        while (position < bytes.size()) {
+            const auto delta = readVarint(bytes, position);
+            const auto numerator = readVarint(bytes, position);
+            const auto denominator = readVarint(bytes, position);
+            const auto targetMilliseconds = readVarint(bytes, position);
+            const auto maxFilters = readVarint(bytes, position);
+            // A capture cut short by a crash, or damaged, still replays up to its last complete valid record. The
+            // target goes through the same limits as a typed one.
+            if (!delta || !numerator || !denominator || !targetMilliseconds || !maxFilters ||
+                position + 8 > bytes.size() || *maxFilters > std::numeric_limits<int>::max() ||
+                *targetMilliseconds < ParetoQuery::minimalTargetMilliseconds ||
+                *targetMilliseconds > ParetoQuery::maximalTargetMilliseconds) {
+                break;
+            }
+            timestampNs += *delta;
+
+            std::uint64_t hash = 0;
+            for (int i = 0; i < 8; i++) {
+                hash |= static_cast<std::uint64_t>(static_cast<unsigned char>(bytes[position++])) << (8 * i);
+            }
+
+            const auto shutter = std::ranges::find_if(shutters, [&](const Shutter &candidate) {
+                return static_cast<std::uint64_t>(candidate.numerator) == *numerator &&
+                       static_cast<std::uint64_t>(candidate.denominator) == *denominator;
+            });
+            if (shutter == shutters.end()) {
+                skipped++;
+                continue;
+            }
+
+            queries.push_back({
+                .timestampNs = timestampNs,
+                .query = {
+                    .shutterIndex = static_cast<std::size_t>(shutter - shutters.begin()),
+                    .targetMilliseconds = static_cast<std::int64_t>(*targetMilliseconds),
+                    .maxFilters = *maxFilters == 0 ? std::numeric_limits<int>::max() : static_cast<int>(*maxFilters)
+                },
+                .resultHash = hash
+            });
+        }
+        return queries;
+    }
+
+    // Re-runs a captured workload through the same query path as the REPL (cache included), either as fast as
+    // possible or keeping the original gaps between queries, and reports throughput, latency percentiles and
+    // every query whose answer differs from the captured one
+    int replayCapture(const std::string &path, const bool paced) {
+        std::size_t skipped = 0;
+        const auto queries = loadCapture(path, skipped);
+        if (!queries) {
+            reportError("Not a query capture: " + path);
+            return 1;
+        }
+
+        LatencyHistogram latencies;
+        std::size_t divergences = 0;
+        const auto start = std::chrono::steady_clock::now();
+
+        for (const auto &[timestampNs, query, resultHash]: *queries) {
+            if (paced) {
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(timestampNs));
+            }
+
+            const auto queryStart = std::chrono::steady_clock::now();
+            const ParetoAnswer result = answerParetoQuery(query);
+            latencies.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - queryStart).count()));
+
+            if (hashText(*result) != resultHash) {
+                divergences++;
+            }
+        }
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        LatencyHistogram::Counts counts{};
+        latencies.addTo(counts);
+
+        standardOutput << std::format("queries {} in {:.3f} s, {:.0f} queries/s\n", queries->size(), seconds,
+                                 seconds > 0.0 ? static_cast<double>(queries->size()) / seconds : 0.0);
+        standardOutput << std::format("latency ns p50={} p90={} p99={} p999={} max={}\n",
+                                 latencyQuantile(counts, 0.5), latencyQuantile(counts, 0.9),
+                                 latencyQuantile(counts, 0.99), latencyQuantile(counts, 0.999),
+                                 latencyQuantile(counts, 1.0));
+        standardOutput << std::format("divergent results {}, skipped {} on shutters this build doesn't have",
+                                      divergences, skipped) << '\n';
+        return divergences == 0 ? 0 : 2;
+    }
+
+    // Readers keep answering Pareto queries while the kit is swapped back and forth under them, reports the query
+    // throughput, how long a swap takes to be visible and how many replaced snapshots were still pinned
+    int benchmarkKitSwap() {
+        const std::array<std::string_view, 4> kitA = {"1k", "64", "8", "4"};
+        const std::array<std::string_view, 5> kitB = {"2k", "256", "32", "4", "2"};
+        const auto stacksA = stacksOfKit(kitA, 3);
+        const auto stacksB = stacksOfKit(kitB, 3);
+        constexpr int swaps = 2000;
+
+        std::atomic<bool> running = true;
+        std::atomic<std::uint64_t> queries = 0;
+        std::atomic<std::uint64_t> inconsistencies = 0;
+        std::vector<std::thread> readers;
+        const unsigned readersCount = std::max(2u, std::max(1u, std::thread::hardware_concurrency()) - 1);
+        for (unsigned reader = 0; reader < readersCount; reader++) {
+            readers.emplace_back([&, reader] {
+                std::uint64_t answered = 0;
+                for (std::size_t i = reader; running.load(std::memory_order_relaxed); i++) {
+                    const KitReadGuard kit;
+                    const auto front = paretoStacks(*kit, shutters[i % shutters.size()], 30.0 * (1 + i % 60));
+                    // A snapshot freed under the reader would show as a front pointing outside of its stacks
+                    for (const auto &stack: front) {
+                        if (stack.filter < kit->stacks.data() || stack.filter >= kit->stacks.data() + kit->stacks.size()
+                            || kit->grid.columns != kit->stacks.size()) {
+                            inconsistencies.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                    answered++;
+                }
+                queries.fetch_add(answered, std::memory_order_relaxed);
+            });
+        }
+
+        std::chrono::duration<double, std::micro> publishing{0};
+        std::size_t maximalPinned = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int swap = 0; swap < swaps; swap++) {
+            auto stacks = swap % 2 == 0 ? *stacksB : *stacksA;
+            const auto publishStart = std::chrono::steady_clock::now();
+            publishKit(std::move(stacks));
+            publishing += std::chrono::steady_clock::now() - publishStart;
+            maximalPinned = std::max(maximalPinned, reclaimRetiredKits());
+            std::this_thread::yield();
+        }
+        running = false;
+        for (auto &reader: readers) {
+            reader.join();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const std::size_t pinnedAtEnd = reclaimRetiredKits();
+
+        standardOutput << std::format("{} readers, {:.0f} queries/s during {} swaps\n", readersCount,
+                                      static_cast<double>(queries.load()) / elapsed.count(), swaps);
+        standardOutput << std::format("publish {:.1f} us per swap (snapshot built and swapped in)\n",
+                                      publishing.count() / swaps);
+        standardOutput << std::format("replaced snapshots still pinned: at most {}, {} at the end\n", maximalPinned,
+                                      pinnedAtEnd);
+        standardOutput << std::format("inconsistent answers {}\n", inconsistencies.load());
+        return inconsistencies.load() == 0 && pinnedAtEnd == 0 ? 0 : 2;
+    }
+
+    // Measures exec-to-exit time of the plain table printing, which is what scripts calling the calculator in a
+    // loop pay for. Runs this binary by default, or another build given by its path to compare them.
+    int benchmarkStartup(const std::string &binary, const int iterations) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+        char *const arguments[] = {const_cast<char *>(binary.c_str()), nullptr};
+        LatencyHistogram latencies;
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < iterations; i++) {
+            const auto runStart = std::chrono::steady_clock::now();
+            pid_t child = 0;
+            if (posix_spawn(&child, binary.c_str(), &actions, nullptr, arguments, environ) != 0) {
+                posix_spawn_file_actions_destroy(&actions);
+                reportError("Can't execute " + binary);
+                return 1;
+            }
+
+            int status = 0;
+            waitpid(child, &status, 0);
+            latencies.record(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - runStart).count()));
+        }
+
+        posix_spawn_file_actions_destroy(&actions);
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        LatencyHistogram::Counts counts{};
+        latencies.addTo(counts);
+
+        standardOutput << std::format("{} runs of {}, mean {:.1f} us, p50 {} us, p99 {} us\n", iterations, binary,
+                                      seconds * 1e6 / iterations, latencyQuantile(counts, 0.5) / 1000,
+                                      latencyQuantile(counts, 0.99) / 1000);
+        return 0;
+    }
+
+    // Long-lived interactive mode, reads one command per line from the standard input:
+    //   pareto <shutter> <target seconds> [max filters]
+    //   stats
+    //   metrics
+    //   quit
+    // When a capture is given, every answered query is appended to it for a later replay.
+    void runRepl(QueryCapture *capture) {
+        FdLineReader input(STDIN_FILENO);
+        std::string line;
+        while (input.readLine(line)) {
+            const auto words = splitWords(line);
+            if (words.empty()) {
+                continue;
+            }
+
+            if (words[0] == "quit") {
+                break;
+            }
+
+            if (words[0] == "stats") {
+                standardOutput << renderCacheStats();
+                standardOutput.flush();
+                continue;
             }
 
-            displayCsvRow(shutters[i]);
+            if (words[0] == "metrics") {
+                standardOutput << renderMetrics();
+                standardOutput.flush();
+                continue;
+            }
+
+            if (words[0] == "pareto") {
+                if (const auto query = parseParetoQuery(std::span(words).subspan(1))) {
+                    const ParetoAnswer result = answerParetoQuery(*query);
+                    if (capture != nullptr) {
+                        capture->record(*query, *result);
+                    }
+                    standardOutput << *result;
+                    standardOutput.flush();
+                    continue;
+                }
+            }
+
+            if (words[0] == "kit" && words.size() > 1) {
+                // kit <filters from the catalog>, e.g. kit 1k 64 8 4, queries see the new kit as soon as it is built
+                if (const auto stacks = stacksOfKit(std::span(words).subspan(1), SweepSpec{}.maxFilters)) {
+                    const auto start = std::chrono::steady_clock::now();
+                    const std::uint64_t generation = publishKit(*stacks);
+                    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                    standardOutput << std::format("kit of {} stacks published as generation {} in {} us\n",
+                                                  stacks->size(), generation, elapsed);
+                    standardOutput.flush();
+                    continue;
+                }
+            }
+
+            standardOutput << "error: expected 'pareto <shutter> <seconds> [max filters]', 'kit <filters>', 'stats', "
+                    "'metrics' or 'quit'\n";
+            standardOutput.flush();
         }
     }
 } // end of namespace
 
-int main() {
-    shutter_calculator::populateFiltersWithGeneratedCombinations();
-    shutter_calculator::populateFiltersWithHandPickedCombinations();
-    shutter_calculator::sortFilters();
+int main(const int argc, const char *argv[]) {
+    std::vector<std::string_view> args(argv + 1, argv + argc);
+
+    // --trace <file> in front of any mode records the timeline of the run
+    std::string tracePath;
+    if (args.size() >= 2 && args[0] == "--trace") {
+        tracePath = args[1];
+        args.erase(args.begin(), args.begin() + 2);
+    }
+    const shutter_calculator::TraceDump traceDump(tracePath);
+
+    {
+        const shutter_calculator::ScopedTrace trace("populate");
+        shutter_calculator::populateFiltersWithGeneratedCombinations();
+        shutter_calculator::populateFiltersWithHandPickedCombinations();
+    }
+    {
+        const shutter_calculator::ScopedTrace trace("sort");
+        shutter_calculator::sortFilters();
+    }
+
+    // Only the query modes read the kit snapshot, the plain tables don't pay for its index and exposure matrix
+    constexpr std::array<std::string_view, 5> queryModes = {"pareto", "repl", "replay", "tui", "bench-kit-swap"};
+    if (!args.empty() && std::ranges::find(queryModes, args[0]) != queryModes.end()) {
+        const shutter_calculator::ScopedTrace trace("publish kit");
+        shutter_calculator::publishKit(shutter_calculator::combinedFilters);
+    }
+
+    if (args.size() == 3 && args[0] == "pareto") {
+        // pareto <metered shutter as printed in the first column> <target seconds>
+        const auto base = shutter_calculator::findShutter(args[1]);
+        double targetSeconds = 0.0;
+        if (base == nullptr || !shutter_calculator::parseTargetSeconds(args[2], targetSeconds)) {
+            shutter_calculator::reportError("Usage: pareto <shutter, e.g. 400 or 3\"2> <target seconds>");
+            return 1;
+        }
+
+        shutter_calculator::displayParetoStacks(*base, targetSeconds);
+        return 0;
+    }
+
+    if (args.size() == 1 && args[0] == "repl") {
+        shutter_calculator::startMetricsSignalThread();
+        shutter_calculator::runRepl(nullptr);
+        return 0;
+    }
+
+    if (args.size() == 3 && args[0] == "repl" && args[1] == "--capture") {
+        shutter_calculator::QueryCapture capture{std::string(args[2])};
+        if (!capture.isOpen()) {
+            shutter_calculator::reportError(std::format("Can't create the capture file {}", args[2]));
+            return 1;
+        }
 
-    shutter_calculator::displayMarkdownTable();
-    shutter_calculator::displayCsvTable();
+        shutter_calculator::startMetricsSignalThread();
+        shutter_calculator::runRepl(&capture);
+        return 0;
+    }
+
+    if ((args.size() == 2 || args.size() == 3) && args[0] == "replay") {
+        // replay <capture> [--paced]
+        const bool paced = args.size() == 3 && args[2] == "--paced";
+        if (args.size() == 3 && !paced) {
+            shutter_calculator::reportError("Usage: replay <capture file> [--paced]");
+            return 1;
+        }
+        return shutter_calculator::replayCapture(std::string(args[1]), paced);
+    }
+
+    if (args.size() == 1 && args[0] == "compact-check") {
+        return shutter_calculator::checkCompactTable();
+    }
+
+    if (args.size() == 2 && args[0] == "export-compact") {
+        const auto bytes = shutter_calculator::encodeCompactTable(
+            shutter_calculator::filters, shutter_calculator::combinedFilters, shutter_calculator::shutters);
+        const int file = open(std::string(args[1]).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const bool written = bytes && file >= 0 && shutter_calculator::writeAll(file, *bytes);
+        if (file >= 0) {
+            ::close(file);
+        }
+        if (!written) {
+            shutter_calculator::reportError(std::format("Can't write the compact table {}", args[1]));
+            return 1;
+        }
+        return 0;
+    }
+
+    if (args.size() == 1 && args[0] == "tui") {
+        return shutter_calculator::runTableViewer();
+    }
+
+    if ((args.size() == 1 || args.size() == 2) && args[0] == "bench-render") {
+        // bench-render [stacks]
+        std::size_t stacks = 100'000;
+        if (args.size() == 2 && (!shutter_calculator::parseNumber(args[1], stacks) || stacks == 0)) {
+            shutter_calculator::reportError("Usage: bench-render [stacks]");
+            return 1;
+        }
+        return shutter_calculator::benchmarkRender(stacks);
+    }
+
+    if (args.size() == 1 && args[0] == "bench-kit-swap") {
+        return shutter_calculator::benchmarkKitSwap();
+    }
+
+    if (args.size() == 1 && args[0] == "bench-metrics") {
+        shutter_calculator::benchmarkMetrics();
+        return 0;
+    }
+
+    if (args.size() == 1 && args[0] == "bench-search") {
+        shutter_calculator::benchmarkSearch();
+        return 0;
+    }
+
+    if (!args.empty() && args.size() <= 3 && args[0] == "bench-startup") {
+        // bench-startup [binary] [iterations]
+        const std::string binary = args.size() >= 2 ? std::string(args[1]) : "/proc/self/exe";
+        int iterations = 1000;
+        if (args.size() == 3 && (!shutter_calculator::parseNumber(args[2], iterations) || iterations <= 0)) {
+            shutter_calculator::reportError("Usage: bench-startup [binary] [iterations]");
+            return 1;
+        }
+        return shutter_calculator::benchmarkStartup(binary, iterations);
+    }
+
+    if (args.size() == 2 && args[0] == "export-arrow") {
+        const int file = open(std::string(args[1]).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const shutter_calculator::ScopedTrace trace("export arrow");
+        const bool written = file >= 0 && shutter_calculator::writeArrowFile(file);
+        if (file >= 0) {
+            ::close(file);
+        }
+        if (!written) {
+            shutter_calculator::reportError(std::format("Can't write the Arrow file {}", args[1]));
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!args.empty() && (args[0] == "sweep" || (args[0] == "sweep-init" && args.size() >= 2))) {
+        // sweep [--kit-size n] [--max-filters n] [--checkpoint <file> [--resume] [--checkpoint-interval <seconds>]]
+        // sweep-init <directory> [--kit-size n] [--max-filters n]
+        const bool init = args[0] == "sweep-init";
+        shutter_calculator::SweepSpec spec;
+        std::string checkpointPath;
+        bool resume = false;
+        double intervalSeconds = 10.0;
+        bool valid = true;
+        for (std::size_t i = init ? 2 : 1; i < args.size() && valid; i++) {
+            if (args[i] == "--kit-size" && i + 1 < args.size()) {
+                valid = shutter_calculator::parseNumber(args[++i], spec.kitSize);
+            } else if (args[i] == "--max-filters" && i + 1 < args.size()) {
+                valid = shutter_calculator::parseNumber(args[++i], spec.maxFilters);
+            } else if (init) {
+                valid = false;
+            } else if (args[i] == "--checkpoint" && i + 1 < args.size()) {
+                checkpointPath = args[++i];
+            } else if (args[i] == "--checkpoint-interval" && i + 1 < args.size()) {
+                valid = shutter_calculator::parseNumber(args[++i], intervalSeconds) && intervalSeconds >= 0.0;
+            } else if (args[i] == "--resume") {
+                resume = true;
+            } else {
+                valid = false;
+            }
+        }
+        // A stack can't hold more filters than the kit, a larger limit is the same sweep as no limit at all
+        spec.maxFilters = std::min(spec.maxFilters, spec.kitSize);
+        if (!valid || spec.kitSize < 1 || spec.kitSize > 8 || spec.maxFilters < 1 ||
+            (resume && checkpointPath.empty())) {
+            shutter_calculator::reportError("Usage: sweep [--kit-size 1-8] [--max-filters n] "
+                "[--checkpoint <file> [--resume] [--checkpoint-interval <seconds>]]\n"
+                "       sweep-init <directory> [--kit-size 1-8] [--max-filters n]");
+            return 1;
+        }
+        if (init) {
+            return shutter_calculator::initSweepDirectory(std::string(args[1]), spec);
+        }
+        return shutter_calculator::runSweep(spec, checkpointPath, resume,
+                                            std::chrono::duration<double>(intervalSeconds));
+    }
+
+    if ((args.size() == 2 || args.size() == 3) && args[0] == "sweep-worker") {
+        // sweep-worker <directory> [worker name], unique per worker, the host name and the pid by default
+        std::array<char, 256> host{};
+        gethostname(host.data(), host.size() - 1);
+        const std::string worker = args.size() == 3
+                                       ? std::string(args[2])
+                                       : std::format("{}-{}", host.data(), getpid());
+        if (!shutter_calculator::isValidWorkerName(worker)) {
+            shutter_calculator::reportError("A worker name can't be empty, start with a dot or contain a /");
+            return 1;
+        }
+        return shutter_calculator::runSweepWorker(std::string(args[1]), worker);
+    }
+
+    if ((args.size() == 2 || args.size() == 3) && args[0] == "sweep-requeue") {
+        // sweep-requeue <directory> [worker name], the items claimed by every worker without a name
+        std::optional<std::string> worker;
+        if (args.size() == 3) {
+            worker = args[2];
+        }
+        if (worker && !shutter_calculator::isValidWorkerName(*worker)) {
+            shutter_calculator::reportError("A worker name can't be empty, start with a dot or contain a /");
+            return 1;
+        }
+        return shutter_calculator::requeueSweepItems(std::string(args[1]), worker);
+    }
+
+    if (args.size() == 2 && args[0] == "sweep-merge") {
+        return shutter_calculator::mergeSweepDirectory(std::string(args[1]));
+    }
+
+    if (args.size() == 1 && args[0] == "bench-arithmetic") {
+        shutter_calculator::benchmarkArithmetic();
+        return 0;
+    }
+
+    // [--output <file>] [--gzip] [--style canon|precise|unlimited] [--arithmetic int|fixed|rational|double],
+    // a file ending with .gz is always compressed
+    std::string_view outputPath;
+    bool gzip = false;
+    auto displayTables = &shutter_calculator::displayTables<shutter_calculator::Canon90dStyle>;
+    auto computeGrid = &shutter_calculator::computeFiltersGrid<shutter_calculator::IntegerStops>;
+    for (std::size_t i = 0; i < args.size(); i++) {
+        if (args[i] == "--output" && i + 1 < args.size()) {
+            outputPath = args[++i];
+            gzip = gzip || outputPath.ends_with(".gz");
+        } else if (args[i] == "--gzip") {
+            gzip = true;
+        } else if (const auto style = args[i] == "--style" && i + 1 < args.size()
+                                          ? shutter_calculator::tablesRendererForStyle(args[++i])
+                                          : std::nullopt) {
+            displayTables = *style;
+        } else if (const auto arithmetic = args[i] == "--arithmetic" && i + 1 < args.size()
+                                               ? shutter_calculator::gridComputationFor(args[++i])
+                                               : std::nullopt) {
+            computeGrid = *arithmetic;
+        } else {
+            shutter_calculator::reportError("Usage: [--output <file>] [--gzip] [--style canon|precise|unlimited] "
+                "[--arithmetic int|fixed|rational|double]");
+            return 1;
+        }
+    }
+
+    if (!outputPath.empty()) {
+        const int file = open(std::string(outputPath).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0 || dup2(file, STDOUT_FILENO) < 0) {
+            shutter_calculator::reportError(std::format("Can't create the output file {}", outputPath));
+            return 1;
+        }
+        ::close(file);
+    }
+
+    if (gzip) {
+        shutter_calculator::standardOutput.compressWithGzip();
+    }
+
+    shutter_calculator::ExposureGrid grid;
+    {
+        const shutter_calculator::ScopedTrace trace("compute");
+        grid = computeGrid();
+    }
+    {
+        const shutter_calculator::ScopedTrace trace("format");
+        displayTables(grid);
+    }
+    if (!shutter_calculator::standardOutput.close()) {
+        shutter_calculator::reportError(outputPath.empty()
+                                            ? std::string("Can't write the tables")
+                                            : std::format("Can't write the tables into {}", outputPath));
+        return 1;
+    }
 
     return 0;
 }
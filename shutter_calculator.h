@@ -0,0 +1,797 @@
+// Types and helpers shared by the translation units of the calculator
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <compare>
+#include <concepts>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <initializer_list>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "gzip_stream.h"
+
+namespace shutter_calculator {
+    // Appends the integer right aligned to the given width, like std::format("{:7}") or "{:02}" with a '0' fill
+    inline void appendPadded(std::string &text, const int value, const int width, const char fill = ' ') {
+        std::array<char, 16> digits;
+        const auto [end, _] = std::to_chars(digits.begin(), digits.end(), value);
+        const auto length = static_cast<int>(end - digits.begin());
+        text.append(static_cast<std::size_t>(std::max(width - length, 0)), fill);
+        text.append(digits.begin(), end);
+    }
+
+    // Lightweight timeline of the pipeline stages, dumped as Chrome/Perfetto trace JSON. Every thread records
+    // complete events into its own ring buffer (the oldest events are overwritten when it is full), so workers
+    // never contend; when tracing is off a scope costs one relaxed load. The background work runs on the worker
+    // pool, so there is a ring per core and not per task, and each one grows by chunks up to its capacity.
+    extern std::atomic<bool> tracingEnabled;
+
+    struct TraceEvent {
+        const char *name;
+        std::uint64_t startNs;
+        std::uint64_t durationNs;
+        std::int64_t item; // Sweep item, row block... or -1 when the event is not about one
+    };
+
+    struct TraceRing {
+        static constexpr std::size_t capacity = 1 << 14;
+        static constexpr std::size_t chunkSize = 256;
+
+        using Chunk = std::array<TraceEvent, chunkSize>;
+
+        std::uint32_t threadId;
+        std::atomic<std::uint64_t> recorded = 0;
+        std::array<std::unique_ptr<Chunk>, capacity / chunkSize> chunks; // Allocated once the events reach them
+
+        void push(const TraceEvent &event) {
+            const std::uint64_t index = recorded.load(std::memory_order_relaxed);
+            auto &chunk = chunks[index % capacity / chunkSize];
+            if (!chunk) {
+                chunk = std::make_unique<Chunk>();
+            }
+            (*chunk)[index % chunkSize] = event;
+            recorded.store(index + 1, std::memory_order_release);
+        }
+
+        // Any of the last capacity events, up to recorded
+        [[nodiscard]] const TraceEvent &at(const std::uint64_t index) const {
+            return (*chunks[index % capacity / chunkSize])[index % chunkSize];
+        }
+    };
+
+    TraceRing &threadTraceRing();
+
+    // Nanoseconds since the start of the program
+    std::uint64_t traceNow();
+
+    class ScopedTrace {
+    public:
+        explicit ScopedTrace(const char *initName, const std::int64_t initItem = -1)
+            : name(initName), item(initItem), enabled(tracingEnabled.load(std::memory_order_relaxed)),
+              startNs(enabled ? traceNow() : 0) {
+        }
+
+        ~ScopedTrace() {
+            if (enabled) {
+                threadTraceRing().push({.name = name, .startNs = startNs, .durationNs = traceNow() - startNs,
+                    .item = item});
+            }
+        }
+
+        ScopedTrace(const ScopedTrace &) = delete;
+
+        ScopedTrace &operator=(const ScopedTrace &) = delete;
+
+    private:
+        const char *const name;
+        const std::int64_t item;
+        const bool enabled;
+        const std::uint64_t startNs;
+    };
+
+    // Writes everything, retrying short writes and interrupted calls
+    bool writeAll(int fd, std::string_view data);
+
+    // writeAll for several buffers, which go out in order with as few writev(2) calls as possible
+    bool writevAll(int fd, std::span<const std::string> buffers);
+
+    // The whole file, nothing when it can't be opened or read
+    std::optional<std::string> readFile(const std::string &path);
+
+    // Buffered writer straight on top of a file descriptor. The tables go out with a single write(2) at exit
+    // instead of a flush per line, and the program doesn't need the iostream machinery (static init and locale
+    // setup) at all, which adds up when scripts run the calculator thousands of times.
+    class FdWriter {
+    public:
+        explicit FdWriter(const int initFd) : fd(initFd) {
+        }
+
+        ~FdWriter() {
+            close();
+        }
+
+        FdWriter(const FdWriter &) = delete;
+
+        FdWriter &operator=(const FdWriter &) = delete;
+
+        FdWriter &operator<<(const std::string_view text) {
+            buffer.append(text);
+            if (buffer.size() >= flushThreshold) {
+                flush();
+            }
+            return *this;
+        }
+
+        FdWriter &operator<<(const char character) {
+            return *this << std::string_view(&character, 1);
+        }
+
+        template<std::integral Integer>
+        FdWriter &operator<<(const Integer value) {
+            std::array<char, 24> digits;
+            const auto [end, _] = std::to_chars(digits.begin(), digits.end(), value);
+            return *this << std::string_view(digits.begin(), end);
+        }
+
+        // Once a write failed the rest is dropped like std::cout would, close() reports it
+        void flush() {
+            if (buffer.empty()) {
+                return;
+            }
+
+            const ScopedTrace trace(gzip ? "compress" : "write");
+            if (gzip) {
+                gzip->write(buffer);
+            } else {
+                failed = failed || !writeAll(fd, buffer);
+            }
+            buffer.clear();
+        }
+
+        // Writes the blocks in order after what is already buffered, without copying them into the buffer
+        void writeBlocks(const std::span<const std::string> blocks) {
+            flush();
+            const ScopedTrace trace(gzip ? "compress" : "write");
+            if (gzip) {
+                for (const auto &block: blocks) {
+                    gzip->write(block);
+                }
+            } else {
+                failed = failed || !writevAll(fd, blocks);
+            }
+        }
+
+        // Everything written from now on is gzip compressed
+        void compressWithGzip() {
+            flush();
+            gzip = std::make_unique<GzipStream>(fd);
+        }
+
+        // Flushes and terminates the compressed stream, if there is one. False when anything written so far, or the
+        // stream, couldn't be written out.
+        bool close() {
+            flush();
+            if (gzip) {
+                failed = !gzip->finish() || failed;
+                gzip.reset();
+            }
+            return !failed;
+        }
+
+    private:
+        static constexpr std::size_t flushThreshold = 1 << 16;
+
+        const int fd;
+        std::string buffer;
+        std::unique_ptr<GzipStream> gzip;
+        bool failed = false;
+    };
+
+    extern FdWriter standardOutput;
+
+    // Errors are not buffered, the whole message and its new line go out in one write(2)
+    void reportError(std::string_view message);
+
+    // Fixed set of hardware_concurrency worker threads shared by everything running in the background (deflating
+    // gzip blocks, formatting row blocks), so a huge table costs a thread per core and not one per block. The
+    // threads start with the first task and are joined at exit. Tasks must not wait for other tasks.
+    class WorkerPool {
+    public:
+        WorkerPool() = default;
+
+        ~WorkerPool() {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            wakeUp.notify_all();
+            for (auto &worker: workers) {
+                worker.join();
+            }
+        }
+
+        WorkerPool(const WorkerPool &) = delete;
+
+        WorkerPool &operator=(const WorkerPool &) = delete;
+
+        template<typename Function>
+        std::future<std::invoke_result_t<Function> > submit(Function function) {
+            std::packaged_task<std::invoke_result_t<Function>()> task(std::move(function));
+            auto future = task.get_future();
+            {
+                std::lock_guard lock(mutex);
+                if (workers.empty()) {
+                    for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++) {
+                        workers.emplace_back([this] { work(); });
+                    }
+                }
+                tasks.emplace_back(std::move(task));
+            }
+            wakeUp.notify_one();
+            return future;
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable wakeUp;
+        std::deque<std::move_only_function<void()> > tasks;
+        std::vector<std::thread> workers;
+        bool stopping = false;
+
+        void work() {
+            while (true) {
+                std::move_only_function<void()> task;
+                {
+                    std::unique_lock lock(mutex);
+                    wakeUp.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (tasks.empty()) {
+                        return;
+                    }
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+    };
+
+    // Shared by the whole program, joined at exit
+    extern WorkerPool workerPool;
+
+    struct Filter {
+        int stops;
+        std::string name;
+        int count = 1; // How many physical filters are stacked together
+
+        auto constexpr operator<=>(const Filter &other) const {
+            return stops <=> other.stops;
+        }
+
+        Filter constexpr operator+(const Filter &other) const {
+            return {
+                .stops = this->stops + other.stops,
+                .name = this->name + " " + other.name,
+                .count = this->count + other.count
+            };
+        }
+
+        [[nodiscard]] std::string toString() const {
+            std::string text(static_cast<std::size_t>(std::max(7 - static_cast<int>(name.size()), 0)), ' ');
+            return text + name;
+        }
+    };
+
+    // Canon 90D can't record for longer than 99h in BULB mode
+    constexpr double bulbLimitSeconds = 100.0 * 60.0 * 60.0;
+
+    // Display styles for the exposure times. Every policy is a set of compile-time constants, the formatter is
+    // instantiated once per policy and the tables are rendered with the chosen one, so a new style costs nothing
+    // in the per-cell loop. All the styles keep the cells 7 characters wide.
+
+    // The default, matching the Canon 90D: 1/x up to 1s/4, s"ms up to 30s, m' s" up to an hour, then h m' up to
+    // the 99h BULB limit
+    struct Canon90dStyle {
+        static constexpr double fractionUpTo = 0.25;
+        static constexpr double decimalUpTo = 30.0;
+        static constexpr int minutesUpTo = 60;
+        static constexpr int hoursUpTo = 99;
+        static constexpr bool secondsAboveHour = false;
+        static constexpr std::string_view overflow = "x      ";
+    };
+
+    // For long exposures timed with an external intervalometer, shows the seconds above an hour (9h59'59 at most)
+    struct PreciseStyle : Canon90dStyle {
+        static constexpr int hoursUpTo = 9;
+        static constexpr bool secondsAboveHour = true;
+        static constexpr std::string_view overflow = "  >10h ";
+    };
+
+    // For bodies without the BULB limit, keeps counting the hours up to 999h
+    struct UnlimitedBulbStyle : Canon90dStyle {
+        static constexpr int hoursUpTo = 999;
+        static constexpr std::string_view overflow = " >999h ";
+    };
+
+    template<typename Style>
+    std::string formatDuration(const double input) {
+        if (input <= Style::fractionUpTo) {
+            // Regular fraction format 1/x is used upto 1s/4
+            std::string text;
+            appendPadded(text, static_cast<int>(std::round(1.0 / input)), 7);
+            return text;
+        } else if (input <= Style::decimalUpTo) {
+            // Regular s"ms format used between 1s/4 and 30s
+            int second = std::floor(input);
+            int leftOver = static_cast<int>(std::round((input - second) * 10));
+            std::string text;
+            appendPadded(text, second, 5);
+            text += '"';
+            appendPadded(text, leftOver, 0);
+            return text;
+        }
+
+        // It's longer than 30 seconds, need to use BULB mode format
+        const int secondTotal = std::ceil(input);
+        const int minutesTotal = secondTotal / 60;
+        const int seconds = secondTotal % 60;
+
+        if (minutesTotal <= Style::minutesUpTo) {
+            // it's under 1h then do not display hours yet
+            std::string text;
+            appendPadded(text, minutesTotal, 2);
+            text += "' ";
+            appendPadded(text, seconds, 2, '0');
+            text += '"';
+            return text;
+        }
+
+        // It's over 60mins
+        const int hours = minutesTotal / 60;
+        const int minutes = minutesTotal % 60;
+
+        if (hours > Style::hoursUpTo) {
+            // The camera can't record this long in BULB mode, no point to display anything
+            return std::string(Style::overflow);
+        }
+
+        std::string text;
+        if constexpr (Style::secondsAboveHour) {
+            // Display hours, minutes and seconds
+            appendPadded(text, hours, 1);
+            text += 'h';
+            appendPadded(text, minutes, 2, '0');
+            text += '\'';
+            appendPadded(text, seconds, 2, '0');
+        } else {
+            // Display BULB hours and minutes (but omit seconds)
+            appendPadded(text, hours, Style::hoursUpTo > 99 ? 3 : 2);
+            text += Style::hoursUpTo > 99 ? "h" : "h ";
+            appendPadded(text, minutes, 2, '0');
+            text += '\'';
+        }
+        return text;
+    }
+
+    struct Shutter {
+        double time;
+
+        // The same time as an exact fraction, for the arithmetic which must not round
+        int numerator;
+        int denominator;
+
+        explicit constexpr Shutter(const int initFraction) {
+            time = 1.0 / initFraction;
+            numerator = 1;
+            denominator = initFraction;
+        }
+
+        explicit constexpr Shutter(const int initSeconds, const int initHundredsMiliseconds) {
+            time = initSeconds + initHundredsMiliseconds / 10.0;
+            numerator = initSeconds * 10 + initHundredsMiliseconds;
+            denominator = 10;
+        }
+
+        template<typename Style = Canon90dStyle>
+        [[nodiscard]] std::string toStringWithFilterStops(const int stops) const {
+            // Increase the shutter time first by x amount of stops and then print it
+            const double increasedShutterTime = timeWithFilterStops(stops);
+            return formatDuration<Style>(increasedShutterTime);
+        }
+
+        template<typename Style = Canon90dStyle>
+        [[nodiscard]] std::string toString() const {
+            return formatDuration<Style>(time);
+        }
+
+        // Exact scaling by 2^stops, also past the 31 stops an int shift could take (stacks of a swapped kit reach 40+)
+        [[nodiscard]] double timeWithFilterStops(const int stops) const {
+            return std::ldexp(time, stops);
+        }
+
+        [[nodiscard]] static std::string durationToString(const double input) {
+            return formatDuration<Canon90dStyle>(input);
+        }
+    };
+
+    // My personal selection of ND filters
+    inline constexpr std::array<Filter, 4> filters = {
+        {
+            {10, "1k"}, // ND1000 = 10 stops
+            {6, "64"}, // ND64   = 6 stops
+            {3, "8"}, // ND8    = 3 stops
+            {2, "4"}, // ND4    = 2 stops
+        }
+    };
+
+    // Will hold various combinations of the filters
+    extern std::vector<Filter> combinedFilters;
+
+    // Shutter speeds supported by my Canon 90D but commented some extreme values I will not need
+    inline constexpr std::array<Shutter, 52> shutters = {
+        {
+            // Fraction-based shutter speeds, for example: 800 = 1/8000s
+            // Shutter(8000),
+            // Shutter(6400),
+            // Shutter(5000),
+            Shutter(4000),
+            Shutter(3200),
+            Shutter(2500),
+            Shutter(2000),
+            Shutter(1600),
+            Shutter(1250),
+            Shutter(1000),
+            Shutter(800),
+            Shutter(640),
+            Shutter(500),
+            Shutter(400),
+            Shutter(320),
+            Shutter(250),
+            Shutter(200),
+            Shutter(160),
+            Shutter(125),
+            Shutter(100),
+            Shutter(80),
+            Shutter(60),
+            Shutter(50),
+            Shutter(40),
+            Shutter(30),
+            Shutter(25),
+            Shutter(20),
+            Shutter(15),
+            Shutter(13),
+            Shutter(10),
+            Shutter(8),
+            Shutter(6),
+            Shutter(5), // 1/5 => 0.200s
+            Shutter(4), // 1/4 => 0.250s
+
+            // Decimal second based shutter speeds, for example 3"2 = 3.2s
+            Shutter(0, 3), //  0.3s
+            Shutter(0, 4), //  0.4s
+            Shutter(0, 5), //  0.5s
+            Shutter(0, 6), //  0.6s
+            Shutter(0, 8), //  0.8s
+            Shutter(1, 0), //  1.0s
+            Shutter(1, 3), //  1.3s
+            Shutter(1, 6), //  1.6s
+            Shutter(2, 0), //  2.0s
+            Shutter(2, 5), //  2.5s
+            Shutter(3, 2), //  3.2s
+            Shutter(4, 0), //  4.0s
+            Shutter(5, 0), //  5.0s
+            Shutter(6, 0), //  6.0s
+            Shutter(8, 0), //  8.0s
+            Shutter(10, 0), // 10.0s
+            Shutter(13, 0), // 13.0s
+            Shutter(15, 0), // 15.0s
+            Shutter(20, 0), // 20.0s
+            Shutter(25, 0), // 25.0s
+            Shutter(30, 0), // 30.0s
+        }
+    };
+
+    // Sorted keys stored in the Eytzinger (BFS) layout: the first few levels of the implicit tree share cache lines,
+    // every search step is a predictable arithmetic update instead of a branch, and the grandchildren of the
+    // current node can be prefetched ahead of time. Answers the same as std::lower_bound on the original array.
+    template<typename Key>
+    class EytzingerIndex {
+    public:
+        EytzingerIndex() = default;
+
+        explicit EytzingerIndex(const std::span<const Key> sorted) : tree(sorted.size() + 1),
+                                                                     positions(sorted.size() + 1) {
+            std::size_t next = 0;
+            build(sorted, next, 1);
+            positions[0] = sorted.size(); // Not found maps to end, same as std::lower_bound
+        }
+
+        [[nodiscard]] std::size_t size() const {
+            return tree.size() - 1;
+        }
+
+        [[nodiscard]] std::size_t lowerBound(const Key key) const {
+            const std::size_t count = size();
+            std::size_t k = 1;
+            while (k <= count) {
+                __builtin_prefetch(tree.data() + std::min(k * prefetchStride, count));
+                k = 2 * k + (tree[k] < key);
+            }
+            return positions[k >> (std::countr_one(k) + 1)];
+        }
+
+        // Resolves a batch of queries in lockstep, groups of lanes descend the tree together so the memory
+        // latency of one lane is hidden behind the loads of the others
+        void lowerBoundBatch(const std::span<const Key> keys, const std::span<std::size_t> results) const {
+            const std::size_t count = size();
+            const int depth = std::bit_width(count);
+
+            std::size_t i = 0;
+            for (; i + lanes <= keys.size(); i += lanes) {
+                std::array<std::size_t, lanes> k;
+                k.fill(1);
+
+                for (int level = 0; level < depth; level++) {
+                    for (std::size_t lane = 0; lane < lanes; lane++) {
+                        // Lanes which already fell out of the tree keep their position, without a branch
+                        const bool inside = k[lane] <= count;
+                        const std::size_t node = inside ? k[lane] : 0;
+                        __builtin_prefetch(tree.data() + std::min(node * prefetchStride, count));
+                        k[lane] = inside ? 2 * k[lane] + (tree[node] < keys[i + lane]) : k[lane];
+                    }
+                }
+
+                for (std::size_t lane = 0; lane < lanes; lane++) {
+                    results[i + lane] = positions[k[lane] >> (std::countr_one(k[lane]) + 1)];
+                }
+            }
+
+            for (; i < keys.size(); i++) {
+                results[i] = lowerBound(keys[i]);
+            }
+        }
+
+    private:
+        static constexpr std::size_t lanes = 8;
+
+        // Four levels ahead, the 16 descendants are contiguous and fit a 64B cache line for 4B keys
+        static constexpr std::size_t prefetchStride = 16;
+
+        std::vector<Key> tree;
+        std::vector<std::size_t> positions; // Index in the original sorted array for each tree node
+
+        void build(const std::span<const Key> sorted, std::size_t &next, const std::size_t k) {
+            if (k > sorted.size()) {
+                return;
+            }
+            build(sorted, next, 2 * k);
+            tree[k] = sorted[next];
+            positions[k] = next++;
+            build(sorted, next, 2 * k + 1);
+        }
+    };
+
+    // Exposure times in seconds for every shutter (rows) and stops column, stored row after row
+    struct ExposureGrid {
+        std::size_t columns;
+        std::vector<double> durations;
+
+        [[nodiscard]] double at(const std::size_t row, const std::size_t column) const {
+            return durations[row * columns + column];
+        }
+    };
+
+    // Immutable kit as the queries see it: the sorted stacks, their search index and the exposure matrix. A kit swap
+    // builds a new snapshot and publishes it with one atomic exchange, queries running on the previous snapshot
+    // finish on it undisturbed.
+    struct KitSnapshot {
+        std::vector<Filter> stacks;
+        EytzingerIndex<int> stopsIndex;
+        std::vector<int> prefixMinimalCounts; // Fewest filters of the stacks up to each one
+        ExposureGrid grid; // The shutters against the stacks
+        std::uint64_t generation;
+    };
+
+    struct KitReader;
+
+    // Pins the current kit snapshot for the lifetime of the guard. Readers only do a few atomic loads and stores,
+    // they never wait for a kit swap.
+    class KitReadGuard {
+    public:
+        KitReadGuard();
+
+        ~KitReadGuard();
+
+        KitReadGuard(const KitReadGuard &) = delete;
+
+        KitReadGuard &operator=(const KitReadGuard &) = delete;
+
+        const KitSnapshot &operator*() const {
+            return *kit;
+        }
+
+        const KitSnapshot *operator->() const {
+            return kit;
+        }
+
+    private:
+        KitReader &reader;
+        const KitSnapshot *kit;
+    };
+
+    // A filter stack which is not dominated by any other stack for a given target duration
+    struct ParetoStack {
+        const Filter *filter; // Into the kit snapshot the front was computed on
+        double duration;
+        double errorStops; // Positive when the exposure is longer than the target
+    };
+
+    // Returns the Pareto front of the kit's stacks, minimizing both the exposure error (in stops) and the amount of
+    // stacked filters
+    std::vector<ParetoStack> paretoStacks(const KitSnapshot &kit, Shutter base, double targetSeconds,
+                                          int maxFilters = std::numeric_limits<int>::max());
+
+    // Concurrent LRU cache split into independently locked shards, so lookups from different threads rarely
+    // contend. Each shard remembers the kit generation it was filled with and empties itself wholesale the
+    // first time it is touched after the kit changed.
+    template<typename Key, typename Value, typename Hash, std::size_t shardsCount = 16>
+    class ShardedLruCache {
+    public:
+        explicit ShardedLruCache(const std::size_t capacity) : shardCapacity(std::max<std::size_t>(
+            1, capacity / shardsCount)) {
+        }
+
+        std::optional<Value> find(const Key &key, const std::uint64_t generation) {
+            auto &shard = shardFor(key);
+            std::lock_guard lock(shard.mutex);
+            invalidateIfStale(shard, generation);
+
+            const auto found = generation == shard.generation ? shard.entries.find(key) : shard.entries.end();
+            if (found == shard.entries.end()) {
+                misses.fetch_add(1, std::memory_order_relaxed);
+                return std::nullopt;
+            }
+
+            // Move to the front of the recency list
+            shard.recency.splice(shard.recency.begin(), shard.recency, found->second);
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return found->second->second;
+        }
+
+        void insert(const Key &key, Value value, const std::uint64_t generation) {
+            auto &shard = shardFor(key);
+            std::lock_guard lock(shard.mutex);
+            invalidateIfStale(shard, generation);
+            if (generation != shard.generation) {
+                return; // Computed on a kit which has been replaced since
+            }
+
+            if (const auto found = shard.entries.find(key); found != shard.entries.end()) {
+                found->second->second = std::move(value);
+                shard.recency.splice(shard.recency.begin(), shard.recency, found->second);
+                return;
+            }
+
+            if (shard.entries.size() >= shardCapacity) {
+                shard.entries.erase(shard.recency.back().first);
+                shard.recency.pop_back();
+            }
+            shard.recency.emplace_front(key, std::move(value));
+            shard.entries.emplace(key, shard.recency.begin());
+        }
+
+        [[nodiscard]] std::uint64_t hitsCount() const {
+            return hits.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::uint64_t missesCount() const {
+            return misses.load(std::memory_order_relaxed);
+        }
+
+    private:
+        using Recency = std::list<std::pair<Key, Value> >;
+
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::uint64_t generation = 0;
+            Recency recency; // Most recently used at the front
+            std::unordered_map<Key, typename Recency::iterator, Hash> entries;
+        };
+
+        const std::size_t shardCapacity;
+        std::array<Shard, shardsCount> shards;
+        std::atomic<std::uint64_t> hits = 0;
+        std::atomic<std::uint64_t> misses = 0;
+
+        Shard &shardFor(const Key &key) {
+            // The low bits pick the bucket inside the shard's map, use the high bits for the shard
+            return shards[(Hash{}(key) >> 48) % shardsCount];
+        }
+
+        // Only a newer generation clears the shard, a straggler still running on the previous kit gets misses
+        // instead of throwing away what the new kit's queries already cached
+        static void invalidateIfStale(Shard &shard, const std::uint64_t generation) {
+            if (generation > shard.generation) {
+                shard.entries.clear();
+                shard.recency.clear();
+                shard.generation = generation;
+            }
+        }
+    };
+
+    // A Pareto query normalized so equivalent inputs share a cache entry: the shutter by its position in the
+    // ladder and the target rounded to whole milliseconds
+    struct ParetoQuery {
+        std::size_t shutterIndex;
+        std::int64_t targetMilliseconds;
+        int maxFilters;
+
+        // Targets are kept to the millisecond, and none is longer than any BULB timer
+        static constexpr std::int64_t minimalTargetMilliseconds = 1;
+        static constexpr std::int64_t maximalTargetMilliseconds = 1000ll * 3600 * 1000;
+
+        bool operator==(const ParetoQuery &other) const = default;
+
+        [[nodiscard]] double targetSeconds() const {
+            return static_cast<double>(targetMilliseconds) / 1000.0;
+        }
+    };
+
+    // Hash of the cache keys: the fields are packed with a multiply and a xor each, then mixed by the splitmix64
+    // finalizer
+    std::uint64_t hashFields(std::initializer_list<std::uint64_t> fields);
+
+    std::vector<std::string_view> splitWords(std::string_view line);
+
+    // Parses "<shutter> <target seconds> [max filters]" into a normalized query
+    std::optional<ParetoQuery> parseParetoQuery(std::span<const std::string_view> words);
+
+    template<typename Number>
+    bool parseNumber(const std::string_view text, Number &value) {
+        const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        return error == std::errc() && end == text.data() + text.size();
+    }
+
+    // LEB128, 7 bits per byte starting with the lowest ones
+    inline void appendVarint(std::string &bytes, std::uint64_t value) {
+        while (value >= 0x80) {
+            bytes.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        bytes.push_back(static_cast<char>(value));
+    }
+
+    inline std::optional<std::uint64_t> readVarint(const std::string_view bytes, std::size_t &position) {
+        std::uint64_t value = 0;
+        for (int shift = 0; shift < 64 && position < bytes.size(); shift += 7) {
+            const auto byte = static_cast<unsigned char>(bytes[position++]);
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // FNV-1a, cheap and stable across builds and machines
+    std::uint64_t hashText(std::string_view text);
+} // end of namespace
@@ -0,0 +1,287 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace shutter_calculator {
+    // Long exposures in seconds the kits are scored on, from every shutter of the ladder
+    constexpr std::array<double, 8> sweepTargets = {15, 30, 60, 120, 240, 480, 900, 1800};
+
+    std::uint64_t binomial(const int n, const int k) {
+        if (k < 0 || k > n) {
+            return 0;
+        }
+        std::uint64_t result = 1;
+        for (int i = 1; i <= k; i++) {
+            result = result * static_cast<std::uint64_t>(n - k + i) / static_cast<std::uint64_t>(i);
+        }
+        return result;
+    }
+
+    std::uint64_t sweepItemsCount(const SweepSpec &spec) {
+        const std::uint64_t kits = binomial(static_cast<int>(filterCatalog.size()), spec.kitSize);
+        return (kits + kitsPerSweepItem - 1) / kitsPerSweepItem;
+    }
+
+    // Catalog indexes of the kit with the given rank
+    std::vector<int> kitFromRank(std::uint64_t rank, const int kitSize) {
+        std::vector<int> kit;
+        for (int candidate = 0, remaining = kitSize; remaining > 0; candidate++) {
+            const std::uint64_t kitsWithCandidate =
+                    binomial(static_cast<int>(filterCatalog.size()) - candidate - 1, remaining - 1);
+            if (rank < kitsWithCandidate) {
+                kit.push_back(candidate);
+                remaining--;
+            } else {
+                rank -= kitsWithCandidate;
+            }
+        }
+        return kit;
+    }
+
+    std::string kitToString(const std::uint64_t rank, const int kitSize) {
+        std::string text;
+        for (const int index: kitFromRank(rank, kitSize)) {
+            text += text.empty() ? "" : " ";
+            text += filterCatalog[index].name;
+        }
+        return text;
+    }
+
+    KitScore scoreKit(const std::uint64_t rank, const SweepSpec &spec) {
+        const auto kit = kitFromRank(rank, spec.kitSize);
+
+        std::vector<int> stacks;
+        for (std::uint32_t mask = 1; mask < (1u << kit.size()); mask++) {
+            if (std::popcount(mask) <= spec.maxFilters) {
+                int stops = 0;
+                for (std::size_t i = 0; i < kit.size(); i++) {
+                    stops += (mask >> i & 1) ? filterCatalog[kit[i]].stops : 0;
+                }
+                stacks.push_back(stops);
+            }
+        }
+        std::ranges::sort(stacks);
+
+        double worst = 0.0;
+        double sum = 0.0;
+        int count = 0;
+        for (const auto &shutter: shutters) {
+            for (const double target: sweepTargets) {
+                const double neededStops = std::log2(target / shutter.time);
+                if (neededStops < 1.0) {
+                    continue; // Reachable without any filter
+                }
+
+                const auto above = std::ranges::lower_bound(stacks, neededStops);
+                double error = std::numeric_limits<double>::infinity();
+                if (above != stacks.end()) {
+                    error = *above - neededStops;
+                }
+                if (above != stacks.begin()) {
+                    error = std::min(error, neededStops - *std::prev(above));
+                }
+                worst = std::max(worst, error);
+                sum += error;
+                count++;
+            }
+        }
+        return {.kit = rank, .worstError = worst, .meanError = count > 0 ? sum / count : 0.0};
+    }
+
+    void mergeBestKits(std::vector<KitScore> &best, const KitScore &score) {
+        if (best.size() == sweepBestCount && !(score < best.back())) {
+            return;
+        }
+        best.insert(std::upper_bound(best.begin(), best.end(), score), score);
+        if (best.size() > sweepBestCount) {
+            best.pop_back();
+        }
+    }
+
+    std::vector<KitScore> scoreSweepItem(const SweepSpec &spec, const std::uint64_t item) {
+        const ScopedTrace trace("sweep item", static_cast<std::int64_t>(item));
+        const std::uint64_t kits = binomial(static_cast<int>(filterCatalog.size()), spec.kitSize);
+
+        const std::uint64_t end = std::min(kits, (item + 1) * kitsPerSweepItem);
+
+        std::vector<KitScore> best;
+        for (std::uint64_t rank = item * kitsPerSweepItem; rank < end; rank++) {
+            mergeBestKits(best, scoreKit(rank, spec));
+        }
+        return best;
+    }
+
+    bool writeFileAtomically(const std::string &path, const std::string_view bytes) {
+        const std::string temporary = path + ".tmp";
+        const int file = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const bool written = file >= 0 && writeAll(file, bytes) && fsync(file) == 0;
+        if (file >= 0) {
+            ::close(file);
+        }
+        if (!written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+            return false;
+        }
+
+        const std::size_t slash = path.rfind('/');
+        const std::string parent = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        const int directory = open(parent.c_str(), O_RDONLY | O_DIRECTORY);
+        const bool synced = directory >= 0 && fsync(directory) == 0;
+        if (directory >= 0) {
+            ::close(directory);
+        }
+        return synced;
+    }
+
+    constexpr std::string_view sweepCheckpointMagic = "SCSWEEP1";
+
+    std::string encodeSweepProgress(const SweepProgress &progress) {
+        std::string bytes(sweepCheckpointMagic);
+        appendVarint(bytes, static_cast<std::uint64_t>(progress.spec.kitSize));
+        appendVarint(bytes, static_cast<std::uint64_t>(progress.spec.maxFilters));
+        appendVarint(bytes, filterCatalog.size());
+        appendVarint(bytes, kitsPerSweepItem);
+        appendVarint(bytes, progress.nextItem);
+        appendVarint(bytes, progress.best.size());
+        for (const auto &score: progress.best) {
+            appendVarint(bytes, score.kit);
+        }
+        return bytes;
+    }
+
+    std::optional<SweepProgress> decodeSweepProgress(const std::string_view bytes) {
+        if (!bytes.starts_with(sweepCheckpointMagic)) {
+            return std::nullopt;
+        }
+
+        std::size_t position = sweepCheckpointMagic.size();
+        const auto kitSize = readVarint(bytes, position);
+        const auto maxFilters = readVarint(bytes, position);
+        const auto catalogSize = readVarint(bytes, position);
+        const auto itemSize = readVarint(bytes, position);
+        const auto nextItem = readVarint(bytes, position);
+        const auto bestCount = readVarint(bytes, position);
+        if (!kitSize || !maxFilters || !catalogSize || !itemSize || !nextItem || !bestCount ||
+            *catalogSize != filterCatalog.size() || *itemSize != kitsPerSweepItem ||
+            *kitSize < 1 || *kitSize > std::min<std::size_t>(filterCatalog.size(), 8) ||
+            *maxFilters < 1 || *maxFilters > *kitSize || *bestCount > sweepBestCount) {
+            return std::nullopt;
+        }
+
+        SweepProgress progress{
+            .spec = {.kitSize = static_cast<int>(*kitSize), .maxFilters = static_cast<int>(*maxFilters)},
+            .nextItem = *nextItem
+        };
+        const std::uint64_t kits = binomial(static_cast<int>(filterCatalog.size()), progress.spec.kitSize);
+        for (std::uint64_t i = 0; i < *bestCount; i++) {
+            const auto kit = readVarint(bytes, position);
+            if (!kit || *kit >= kits) {
+                return std::nullopt;
+            }
+            mergeBestKits(progress.best, scoreKit(*kit, progress.spec));
+        }
+        if (position != bytes.size() || progress.nextItem > sweepItemsCount(progress.spec)) {
+            return std::nullopt;
+        }
+        return progress;
+    }
+
+    std::string formatBestKits(const std::vector<KitScore> &best, const int kitSize) {
+        std::string text = "| worst | mean  | kit\n| ----- | ----- | ---\n";
+        for (const auto &score: best) {
+            text += std::format("| {:5.2f} | {:5.2f} | {}\n", score.worstError, score.meanError,
+                                kitToString(score.kit, kitSize));
+        }
+        return text;
+    }
+
+    std::optional<std::vector<Filter> > stacksOfKit(const std::span<const std::string_view> names,
+                                                    const int maxFilters) {
+        std::vector<Filter> kit;
+        for (const auto name: names) {
+            const auto found = std::ranges::find(filterCatalog, name, &Filter::name);
+            if (found == filterCatalog.end() || kit.size() == 8) {
+                return std::nullopt;
+            }
+            kit.push_back(*found);
+        }
+
+        std::vector<Filter> stacks;
+        for (std::uint32_t mask = 1; mask < (1u << kit.size()); mask++) {
+            if (std::popcount(mask) > maxFilters) {
+                continue;
+            }
+            std::optional<Filter> stack;
+            for (std::size_t i = 0; i < kit.size(); i++) {
+                if (mask >> i & 1) {
+                    stack = stack ? *stack + kit[i] : kit[i];
+                }
+            }
+            stacks.push_back(*stack);
+        }
+        return stacks;
+    }
+
+    int runSweep(const SweepSpec &spec, const std::string &checkpointPath, const bool resume,
+                 const std::chrono::duration<double> checkpointInterval) {
+        SweepProgress progress{.spec = spec};
+        if (resume) {
+            const auto bytes = readFile(checkpointPath);
+            const auto loaded = bytes ? decodeSweepProgress(*bytes) : std::nullopt;
+            if (!loaded || loaded->spec != spec) {
+                reportError(std::format("Can't resume from {}, missing or made for another sweep", checkpointPath));
+                return 1;
+            }
+            progress = *loaded;
+        }
+
+        const std::uint64_t itemsCount = sweepItemsCount(spec);
+        const std::uint64_t firstItem = progress.nextItem;
+        const auto start = std::chrono::steady_clock::now();
+        auto lastCheckpoint = start;
+        std::chrono::duration<double> checkpointsTime{0};
+        int checkpoints = 0;
+
+        while (progress.nextItem < itemsCount) {
+            for (const auto &score: scoreSweepItem(spec, progress.nextItem)) {
+                mergeBestKits(progress.best, score);
+            }
+            progress.nextItem++;
+
+            const auto now = std::chrono::steady_clock::now();
+            if (!checkpointPath.empty() && (now - lastCheckpoint >= checkpointInterval ||
+                                            progress.nextItem == itemsCount)) {
+                const ScopedTrace trace("checkpoint", static_cast<std::int64_t>(progress.nextItem));
+                if (!writeFileAtomically(checkpointPath, encodeSweepProgress(progress))) {
+                    reportError(std::format("Can't write the checkpoint {}", checkpointPath));
+                    return 1;
+                }
+                lastCheckpoint = std::chrono::steady_clock::now();
+                checkpointsTime += lastCheckpoint - now;
+                checkpoints++;
+            }
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        standardOutput << formatBestKits(progress.best, spec.kitSize);
+        standardOutput << std::format("items {}-{} of {}, {:.3f} s, {} checkpoints taking {:.2f}% of the run\n",
+                                      firstItem, itemsCount, itemsCount, elapsed.count(), checkpoints,
+                                      elapsed.count() > 0.0 ? 100.0 * checkpointsTime / elapsed : 0.0);
+        return 0;
+    }
+} // end of namespace
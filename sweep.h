@@ -0,0 +1,101 @@
+// Kit optimizer: the kit of catalog filters whose stacks get closest to a set of long exposures
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "shutter_calculator.h"
+
+namespace shutter_calculator {
+    // Filters the kit optimizer picks from, the usual strengths sold as screw-in or square filters
+    inline constexpr std::array<Filter, 14> filterCatalog = {
+        {
+            {1, "2"},
+            {2, "4"},
+            {3, "8"},
+            {4, "16"},
+            {5, "32"},
+            {6, "64"},
+            {7, "128"},
+            {8, "256"},
+            {9, "500"},
+            {10, "1k"},
+            {11, "2k"},
+            {12, "4k"},
+            {13, "8k"},
+            {16, "64k"},
+        }
+    };
+
+    // Kit optimizer: every kit of kitSize catalog filters is scored by how close its stacks of up to maxFilters
+    // filters get to each target, in stops. The kits are enumerated in the lexicographic order of their catalog
+    // indexes and cut into items of kitsPerSweepItem kits, the unit of the checkpoints and of the work shared
+    // between machines.
+    struct SweepSpec {
+        int kitSize = 4;
+        int maxFilters = 3;
+
+        bool operator==(const SweepSpec &other) const = default;
+    };
+
+    inline constexpr std::uint64_t kitsPerSweepItem = 256;
+    inline constexpr std::size_t sweepBestCount = 10;
+
+    struct KitScore {
+        std::uint64_t kit; // Rank of the kit in the enumeration
+        double worstError;
+        double meanError;
+
+        // Better kits first, the rank breaks the ties so every run ends with the same list
+        bool operator<(const KitScore &other) const {
+            return std::tie(worstError, meanError, kit) < std::tie(other.worstError, other.meanError, other.kit);
+        }
+    };
+
+    std::uint64_t binomial(int n, int k);
+
+    std::uint64_t sweepItemsCount(const SweepSpec &spec);
+
+    KitScore scoreKit(std::uint64_t rank, const SweepSpec &spec);
+
+    // Keeps the sweepBestCount best kits, best first
+    void mergeBestKits(std::vector<KitScore> &best, const KitScore &score);
+
+    // The best kits of one item
+    std::vector<KitScore> scoreSweepItem(const SweepSpec &spec, std::uint64_t item);
+
+    // Written next to the destination, synced and renamed over it, a crash leaves either the old or the new file.
+    // The directory is synced too, otherwise the rename itself may not survive a power loss.
+    bool writeFileAtomically(const std::string &path, std::string_view bytes);
+
+    // Checkpoint of a sweep, a handful of varints: the sweep parameters, the first item not done yet and the ranks of
+    // the best kits so far. The scores are recomputed from the ranks when resuming, they are exact and cheap.
+    struct SweepProgress {
+        SweepSpec spec;
+        std::uint64_t nextItem = 0; // Every item below is done
+        std::vector<KitScore> best;
+    };
+
+    std::string encodeSweepProgress(const SweepProgress &progress);
+
+    // Nothing when the bytes are not an intact checkpoint of a sweep this build can run
+    std::optional<SweepProgress> decodeSweepProgress(std::string_view bytes);
+
+    std::string formatBestKits(const std::vector<KitScore> &best, int kitSize);
+
+    // Every stack of 1 to maxFilters filters of a kit given by its catalog names, for swapping the kit of a running
+    // query service
+    std::optional<std::vector<Filter> > stacksOfKit(std::span<const std::string_view> names, int maxFilters);
+
+    // Runs the sweep from the checkpoint (when resuming) to the end. The checkpoint is rewritten at most every
+    // checkpointInterval and once more at the end, so a crash loses at most one interval of work.
+    int runSweep(const SweepSpec &spec, const std::string &checkpointPath, bool resume,
+                 std::chrono::duration<double> checkpointInterval);
+} // end of namespace
@@ -0,0 +1,300 @@
+#include "sweep_queue.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shutter_calculator.h"
+
+namespace shutter_calculator {
+    std::string sweepItemName(const std::uint64_t item) {
+        return std::format("item-{:08}", item);
+    }
+
+    // The item of a todo/ or done/ name, or of a claimed/ one up to the worker suffix
+    std::optional<std::uint64_t> parseSweepItemName(const std::string_view name) {
+        const std::string_view itemName = name.substr(0, name.find('.'));
+        std::uint64_t item = 0;
+        if (!itemName.starts_with("item-") || !parseNumber(itemName.substr(5), item)) {
+            return std::nullopt;
+        }
+        return item;
+    }
+
+    bool isValidWorkerName(const std::string_view worker) {
+        return !worker.empty() && !worker.starts_with('.') && worker.find('/') == std::string_view::npos;
+    }
+
+    std::vector<std::string> listDirectory(const std::string &path) {
+        std::vector<std::string> names;
+        if (DIR *directory = opendir(path.c_str())) {
+            while (const dirent *entry = readdir(directory)) {
+                if (entry->d_name[0] != '.') {
+                    names.emplace_back(entry->d_name);
+                }
+            }
+            closedir(directory);
+        }
+        std::ranges::sort(names);
+        return names;
+    }
+
+    std::string encodeShardRecord(const std::uint64_t item, const std::vector<KitScore> &best) {
+        std::string payload;
+        appendVarint(payload, item);
+        appendVarint(payload, best.size());
+        for (const auto &score: best) {
+            appendVarint(payload, score.kit);
+        }
+
+        std::string record;
+        appendVarint(record, payload.size());
+        record += payload;
+        const std::uint32_t crc = crc32Update(0, record);
+        for (int i = 0; i < 4; i++) {
+            record.push_back(static_cast<char>(crc >> (8 * i)));
+        }
+        return record;
+    }
+
+    struct ShardRecord {
+        std::uint64_t item;
+        std::vector<std::uint64_t> ranks;
+    };
+
+    // The next record of a shard, nothing when the rest of the shard isn't a complete and intact record
+    std::optional<ShardRecord> readShardRecord(const std::string_view bytes, std::size_t &position) {
+        std::size_t next = position;
+        const auto length = readVarint(bytes, next);
+        if (!length || *length > bytes.size() - next || bytes.size() - next - *length < 4) {
+            return std::nullopt;
+        }
+        const std::size_t end = next + *length;
+
+        std::uint32_t crc = 0;
+        for (int i = 0; i < 4; i++) {
+            crc |= static_cast<std::uint32_t>(static_cast<unsigned char>(bytes[end + i])) << (8 * i);
+        }
+        if (crc != crc32Update(0, bytes.substr(position, end - position))) {
+            return std::nullopt;
+        }
+
+        const std::string_view payload = bytes.substr(0, end);
+        ShardRecord record;
+        const auto item = readVarint(payload, next);
+        const auto count = readVarint(payload, next);
+        for (std::uint64_t i = 0; count && *count <= sweepBestCount && i < *count; i++) {
+            if (const auto rank = readVarint(payload, next)) {
+                record.ranks.push_back(*rank);
+            }
+        }
+        if (!item || !count || record.ranks.size() != *count || next != end) {
+            return std::nullopt;
+        }
+        record.item = *item;
+        position = end + 4;
+        return record;
+    }
+
+    std::optional<SweepSpec> loadSweepDirectorySpec(const std::string &directory) {
+        const auto bytes = readFile(directory + "/spec");
+        const auto progress = bytes ? decodeSweepProgress(*bytes) : std::nullopt;
+        if (!progress) {
+            reportError(std::format("{} is not a sweep directory", directory));
+            return std::nullopt;
+        }
+        return progress->spec;
+    }
+
+    int initSweepDirectory(const std::string &directory, const SweepSpec &spec) {
+        if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            reportError(std::format("Can't create the sweep directory {}", directory));
+            return 1;
+        }
+        for (const char *subdirectory: {"/todo", "/claimed", "/done", "/shards"}) {
+            if (mkdir((directory + subdirectory).c_str(), 0755) != 0) {
+                reportError(std::format("Can't create {}{}, is the sweep already initialized?", directory,
+                                        subdirectory));
+                return 1;
+            }
+        }
+
+        const std::uint64_t itemsCount = sweepItemsCount(spec);
+        for (std::uint64_t item = 0; item < itemsCount; item++) {
+            const int file = open((directory + "/todo/" + sweepItemName(item)).c_str(), O_WRONLY | O_CREAT, 0644);
+            if (file < 0) {
+                reportError(std::format("Can't queue the item {}", item));
+                return 1;
+            }
+            ::close(file);
+        }
+
+        // Last, the workers don't start before the queue is complete
+        if (!writeFileAtomically(directory + "/spec", encodeSweepProgress({.spec = spec}))) {
+            reportError(std::format("Can't write {}/spec", directory));
+            return 1;
+        }
+        standardOutput << std::format("{} items queued in {}\n", itemsCount, directory);
+        return 0;
+    }
+
+    int runSweepWorker(const std::string &directory, const std::string &worker) {
+        const auto spec = loadSweepDirectorySpec(directory);
+        if (!spec) {
+            return 1;
+        }
+
+        // A worker restarted under the same name appends to its shard, after the last record it completed
+        const std::string shardPath = directory + "/shards/" + worker;
+        const std::string previous = readFile(shardPath).value_or("");
+        std::vector<bool> recorded(sweepItemsCount(*spec), false);
+        std::size_t complete = 0;
+        while (const auto record = readShardRecord(previous, complete)) {
+            if (record->item < recorded.size()) {
+                recorded[record->item] = true;
+            }
+        }
+        const int shard = open(shardPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (shard < 0 || ftruncate(shard, static_cast<off_t>(complete)) != 0) {
+            reportError(std::format("Can't open the shard {}", shardPath));
+            if (shard >= 0) {
+                ::close(shard);
+            }
+            return 1;
+        }
+
+        // The result is durable before the item is marked as done. An item already in the shard (the previous run
+        // stopped between the two) is only marked.
+        std::uint64_t scoredItems = 0;
+        const auto finishItem = [&](const std::uint64_t item, const std::string &claimedPath) {
+            if (!recorded[item]) {
+                const std::string record = encodeShardRecord(item, scoreSweepItem(*spec, item));
+                if (!writeAll(shard, record) || fdatasync(shard) != 0) {
+                    return false;
+                }
+                recorded[item] = true;
+                scoredItems++;
+            }
+            return std::rename(claimedPath.c_str(), (directory + "/done/" + sweepItemName(item)).c_str()) == 0;
+        };
+
+        bool failed = false;
+        const std::string claimSuffix = "." + worker;
+        for (const auto &name: listDirectory(directory + "/claimed")) {
+            const auto item = parseSweepItemName(name);
+            if (failed || !item || *item >= recorded.size() || name != sweepItemName(*item) + claimSuffix) {
+                continue;
+            }
+            failed = !finishItem(*item, directory + "/claimed/" + name);
+            if (failed) {
+                reportError(std::format("Can't record the item {} in {}", *item, shardPath));
+            }
+        }
+
+        for (auto todo = listDirectory(directory + "/todo"); !todo.empty() && !failed;
+             todo = listDirectory(directory + "/todo")) {
+            std::ranges::rotate(todo, todo.begin() + static_cast<std::ptrdiff_t>(hashText(worker) % todo.size()));
+            for (const auto &name: todo) {
+                const auto item = parseSweepItemName(name);
+                if (!item || *item >= recorded.size()) {
+                    continue;
+                }
+
+                const std::string claimedPath = directory + "/claimed/" + name + claimSuffix;
+                {
+                    const ScopedTrace trace("claim", static_cast<std::int64_t>(*item));
+                    if (std::rename((directory + "/todo/" + name).c_str(), claimedPath.c_str()) != 0) {
+                        continue; // Another worker was faster
+                    }
+                }
+
+                failed = !finishItem(*item, claimedPath);
+                if (failed) {
+                    reportError(std::format("Can't record the item {} in {}", *item, shardPath));
+                    break;
+                }
+            }
+        }
+        ::close(shard);
+
+        standardOutput << std::format("worker {} scored {} items\n", worker, scoredItems);
+        return failed ? 1 : 0;
+    }
+
+    int requeueSweepItems(const std::string &directory, const std::optional<std::string> &worker) {
+        if (!loadSweepDirectorySpec(directory)) {
+            return 1;
+        }
+
+        std::uint64_t requeued = 0;
+        for (const auto &name: listDirectory(directory + "/claimed")) {
+            const auto item = parseSweepItemName(name);
+            if (!item || (worker && name != sweepItemName(*item) + "." + *worker)) {
+                continue;
+            }
+            if (std::rename((directory + "/claimed/" + name).c_str(),
+                            (directory + "/todo/" + sweepItemName(*item)).c_str()) != 0) {
+                reportError(std::format("Can't requeue {}", name));
+                return 1;
+            }
+            requeued++;
+        }
+        standardOutput << std::format("{} items requeued\n", requeued);
+        return 0;
+    }
+
+    int mergeSweepDirectory(const std::string &directory) {
+        const auto spec = loadSweepDirectorySpec(directory);
+        if (!spec) {
+            return 1;
+        }
+
+        const std::uint64_t itemsCount = sweepItemsCount(*spec);
+        const std::uint64_t kits = binomial(static_cast<int>(filterCatalog.size()), spec->kitSize);
+        std::vector<bool> merged(itemsCount, false);
+        std::uint64_t mergedCount = 0;
+        std::vector<KitScore> best;
+
+        const auto shards = listDirectory(directory + "/shards");
+        for (const auto &name: shards) {
+            const auto bytes = readFile(directory + "/shards/" + name).value_or("");
+            std::size_t position = 0;
+            while (const auto record = readShardRecord(bytes, position)) {
+                if (record->item >= itemsCount || merged[record->item] ||
+                    std::ranges::any_of(record->ranks, [kits](const std::uint64_t rank) { return rank >= kits; })) {
+                    continue;
+                }
+
+                merged[record->item] = true;
+                mergedCount++;
+                for (const auto rank: record->ranks) {
+                    mergeBestKits(best, scoreKit(rank, *spec));
+                }
+            }
+            if (position != bytes.size()) {
+                reportError(std::format("Shard {} ends with a torn record, ignored", name));
+            }
+        }
+
+        standardOutput << formatBestKits(best, spec->kitSize);
+        standardOutput << std::format("items {} of {} merged from {} shards\n", mergedCount, itemsCount,
+                                      shards.size());
+        if (mergedCount != itemsCount) {
+            reportError(std::format("{} items are missing, still queued or claimed by a worker which stopped "
+                                    "(restart it under the same name or use sweep-requeue)", itemsCount - mergedCount));
+            return 2;
+        }
+        return 0;
+    }
+} // end of namespace
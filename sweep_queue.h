@@ -0,0 +1,39 @@
+// Sweep shared between machines through a shared directory
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "sweep.h"
+
+namespace shutter_calculator {
+    // A sweep shared between machines through a directory on a shared filesystem, without any coordinator:
+    //   spec      the sweep parameters, as a checkpoint with nothing done
+    //   todo/     an empty file per item, named after the item
+    //   claimed/  a worker claims an item by renaming it out of todo/, rename(2) lets only one worker win
+    //   done/     items whose results are safely in a shard
+    //   shards/   a file per worker with a record per item: its length, then the item, count and ranks of the item's
+    //             best kits, then the CRC-32 of all that. A worker reopening its shard cuts a torn last record off.
+    // Items of a worker which died stay in claimed/ (suffixed with the worker). The worker takes them back when it
+    // is restarted under the same name, otherwise sweep-requeue moves them back to todo/.
+
+    // Worker names become file names in shards/ and claimed/
+    bool isValidWorkerName(std::string_view worker);
+
+    // Creates the directory and queues every item of the sweep in it
+    int initSweepDirectory(const std::string &directory, const SweepSpec &spec);
+
+    // Claims items until the queue is empty. The workers start at different places of the queue so they rarely race
+    // for the same item, and a lost race only costs a failed rename. Items the worker claimed in a previous run
+    // under the same name come first.
+    int runSweepWorker(const std::string &directory, const std::string &worker);
+
+    // Moves the items claimed by a worker which won't be restarted under the same name back to todo/. Without a
+    // name every claimed item goes back, only safe when no worker is running.
+    int requeueSweepItems(const std::string &directory, const std::optional<std::string> &worker);
+
+    // Assembles the best kits from every shard. An item found in several shards (a worker died after writing its
+    // record, the item was queued again) is counted once, a shard is read up to its first damaged record.
+    int mergeSweepDirectory(const std::string &directory);
+} // end of namespace
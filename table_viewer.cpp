@@ -0,0 +1,376 @@
+#include "table_viewer.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "shutter_calculator.h"
+
+namespace shutter_calculator {
+    // Switches the terminal to raw input on the alternate screen and restores it when leaving
+    // Ctrl-C and Ctrl-Z arrive as keys (ISIG is off), a kill or a hang up still restores the terminal before dying
+    class RawTerminal {
+    public:
+        RawTerminal() {
+            active = tcgetattr(STDIN_FILENO, &saved) == 0;
+            if (!active) {
+                return;
+            }
+            restoreOnSignal = saved;
+            struct sigaction action{};
+            action.sa_handler = &restoreAndDie;
+            action.sa_flags = SA_RESETHAND;
+            for (const int signal: {SIGTERM, SIGHUP, SIGQUIT}) {
+                sigaction(signal, &action, nullptr);
+            }
+
+            termios raw = saved;
+            raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO | ISIG);
+            raw.c_oflag &= ~static_cast<tcflag_t>(OPOST); // The frames carry their own \r\n
+            raw.c_cc[VMIN] = 1;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+            writeAll(STDOUT_FILENO, "\x1b[?1049h\x1b[?25l"); // Alternate screen, hide the cursor
+        }
+
+        ~RawTerminal() {
+            if (active) {
+                writeAll(STDOUT_FILENO, "\x1b[?25h\x1b[?1049l");
+                tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved);
+                for (const int signal: {SIGTERM, SIGHUP, SIGQUIT}) {
+                    std::signal(signal, SIG_DFL);
+                }
+            }
+        }
+
+        RawTerminal(const RawTerminal &) = delete;
+
+        RawTerminal &operator=(const RawTerminal &) = delete;
+
+        [[nodiscard]] bool isActive() const {
+            return active;
+        }
+
+    private:
+        static inline termios restoreOnSignal{};
+
+        termios saved{};
+        bool active = false;
+
+        // Only async-signal-safe calls, then the signal is raised again with its default action
+        static void restoreAndDie(const int signal) {
+            constexpr std::string_view restore = "\x1b[?25h\x1b[?1049l";
+            [[maybe_unused]] const ssize_t written = ::write(STDOUT_FILENO, restore.data(), restore.size());
+            tcsetattr(STDIN_FILENO, TCSAFLUSH, &restoreOnSignal);
+            raise(signal);
+        }
+    };
+
+    // Full screen viewer of the exposure table. Only the cells inside the viewport are ever computed and formatted,
+    // in tiles which are memoized, so scrolling costs the same no matter how large the catalog grows.
+    //   arrows / hjkl  scroll by one     PgUp / PgDn  scroll by a page
+    //   /              filter columns    g            jump to the best stack for a shutter and a target
+    //   q / Ctrl-C     quit
+    class TableViewer {
+    public:
+        int run() {
+            const RawTerminal terminal;
+            if (!terminal.isActive()) {
+                reportError("The viewer needs an interactive terminal");
+                return 1;
+            }
+
+            applyFilter("");
+            renderFrame();
+            while (const auto key = readKey()) {
+                if (*key == "q" || *key == "\x03") {
+                    break;
+                }
+                handleKey(*key);
+                // Keys which arrived together (auto-repeat) are all applied before the next frame
+                if (pendingInput.empty()) {
+                    renderFrame();
+                }
+            }
+            return 0;
+        }
+
+    private:
+        static constexpr std::size_t tileRows = 16;
+        static constexpr std::size_t tileColumns = 8;
+        static constexpr int cellWidth = 10; // 7 characters and the " | " separator
+
+        struct Tile {
+            std::array<std::string, tileRows * tileColumns> cells;
+        };
+
+        struct TileKey {
+            std::size_t rowBlock;
+            std::size_t columnBlock;
+
+            bool operator==(const TileKey &other) const = default;
+        };
+
+        struct TileKeyHash {
+            std::size_t operator()(const TileKey &key) const {
+                return hashFields({key.rowBlock, key.columnBlock});
+            }
+        };
+
+        ShardedLruCache<TileKey, std::shared_ptr<const Tile>, TileKeyHash> tiles{1024};
+        std::vector<std::size_t> visibleColumns; // Indexes of the kit stacks which pass the filter
+        std::string filter;
+        std::string pendingInput; // Read from the terminal but not handled yet
+        std::size_t top = 0;
+        std::size_t left = 0; // Index into visibleColumns
+        std::optional<std::pair<std::size_t, std::size_t> > highlight; // Row and stack index
+        std::string status;
+        int screenRows = 24;
+        int screenColumns = 80;
+
+        [[nodiscard]] std::size_t bodyRows() const {
+            return static_cast<std::size_t>(std::max(screenRows - 3, 1)); // Header, separator and status lines
+        }
+
+        [[nodiscard]] std::size_t bodyColumns() const {
+            return static_cast<std::size_t>(std::max((screenColumns - cellWidth - 2) / cellWidth, 1));
+        }
+
+        std::string cell(const std::size_t row, const std::size_t column) {
+            const TileKey key{.rowBlock = row / tileRows, .columnBlock = column / tileColumns};
+            const KitReadGuard kit;
+            const std::uint64_t generation = kit->generation;
+
+            auto tile = tiles.find(key, generation).value_or(nullptr);
+            if (!tile) {
+                auto computed = std::make_shared<Tile>();
+                for (std::size_t r = 0; r < tileRows; r++) {
+                    for (std::size_t c = 0; c < tileColumns; c++) {
+                        const std::size_t tileRow = key.rowBlock * tileRows + r;
+                        const std::size_t tileColumn = key.columnBlock * tileColumns + c;
+                        if (tileRow < shutters.size() && tileColumn < kit->grid.columns) {
+                            computed->cells[r * tileColumns + c] = formatDuration<Canon90dStyle>(
+                                kit->grid.at(tileRow, tileColumn));
+                        }
+                    }
+                }
+                tile = computed;
+                tiles.insert(key, tile, generation);
+            }
+
+            return tile->cells[(row % tileRows) * tileColumns + column % tileColumns];
+        }
+
+        void applyFilter(const std::string_view text) {
+            const KitReadGuard kit;
+            filter = text;
+            visibleColumns.clear();
+            for (std::size_t column = 0; column < kit->stacks.size(); column++) {
+                if (kit->stacks[column].name.find(filter) != std::string::npos) {
+                    visibleColumns.push_back(column);
+                }
+            }
+            left = 0;
+        }
+
+        void scroll(const std::ptrdiff_t rows, const std::ptrdiff_t columns) {
+            const auto clamp = [](const std::size_t position, const std::ptrdiff_t delta, const std::size_t count,
+                                  const std::size_t visible) {
+                const auto last = static_cast<std::ptrdiff_t>(count > visible ? count - visible : 0);
+                return static_cast<std::size_t>(std::clamp(static_cast<std::ptrdiff_t>(position) + delta,
+                                                           std::ptrdiff_t{0}, last));
+            };
+            top = clamp(top, rows, shutters.size(), bodyRows());
+            left = clamp(left, columns, visibleColumns.size(), bodyColumns());
+        }
+
+        // Reads a line typed into the status bar
+        std::string prompt(const std::string_view label) {
+            std::string text;
+            while (true) {
+                status = std::string(label) + text;
+                renderFrame();
+                const auto key = readKey();
+                if (!key || *key == "\n" || *key == "\r") {
+                    return text;
+                }
+                if (*key == "\x7f" || *key == "\b") {
+                    if (!text.empty()) {
+                        text.pop_back();
+                    }
+                } else if (*key == "\x1b" || *key == "\x03") {
+                    return {};
+                } else if (std::ranges::all_of(*key, [](const char c) {
+                    return std::isprint(static_cast<unsigned char>(c));
+                })) {
+                    text += *key; // Typed or pasted text
+                }
+            }
+        }
+
+        void jumpToQuery() {
+            const std::string text = prompt("jump to <shutter> <target seconds>: ");
+            const auto words = splitWords(text);
+            const auto query = parseParetoQuery(words);
+            if (!query) {
+                status = "expected e.g. 400 180";
+                return;
+            }
+
+            const KitReadGuard kit;
+            const auto front = paretoStacks(*kit, shutters[query->shutterIndex], query->targetSeconds());
+            if (front.empty()) {
+                status = "no filter stack fits";
+                return;
+            }
+
+            // The stack closest to the target is the first one of the front
+            const auto column = static_cast<std::size_t>(front.front().filter - kit->stacks.data());
+            applyFilter("");
+            highlight = {query->shutterIndex, column};
+            top = query->shutterIndex;
+            left = column;
+            scroll(-static_cast<std::ptrdiff_t>(bodyRows() / 2), -static_cast<std::ptrdiff_t>(bodyColumns() / 2));
+            status = std::format("{} for {}", kit->stacks[column].toString(),
+                                 Shutter::durationToString(front.front().duration));
+        }
+
+        void handleKey(const std::string_view key) {
+            status.clear();
+            if (key == "\x1b[A" || key == "k") {
+                scroll(-1, 0);
+            } else if (key == "\x1b[B" || key == "j") {
+                scroll(1, 0);
+            } else if (key == "\x1b[D" || key == "h") {
+                scroll(0, -1);
+            } else if (key == "\x1b[C" || key == "l") {
+                scroll(0, 1);
+            } else if (key == "\x1b[5~") {
+                scroll(-static_cast<std::ptrdiff_t>(bodyRows()), 0);
+            } else if (key == "\x1b[6~") {
+                scroll(static_cast<std::ptrdiff_t>(bodyRows()), 0);
+            } else if (key == "/") {
+                applyFilter(prompt("filter columns: "));
+                status.clear();
+            } else if (key == "g") {
+                jumpToQuery();
+            }
+        }
+
+        // One key press, escape sequences of the arrows and page keys are kept together
+        std::optional<std::string> readKey() {
+            while (true) {
+                if (const std::size_t length = nextKeyLength(); length > 0) {
+                    std::string key = pendingInput.substr(0, length);
+                    pendingInput.erase(0, length);
+                    return key;
+                }
+
+                std::array<char, 256> bytes;
+                const ssize_t count = ::read(STDIN_FILENO, bytes.data(), bytes.size());
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    return std::nullopt;
+                }
+                pendingInput.append(bytes.data(), static_cast<std::size_t>(count));
+            }
+        }
+
+        // Length of the first whole key of the pending input, 0 when more bytes are needed. A read can hold several
+        // keys (auto-repeat, paste) and escape sequences: CSI "ESC [ ... final byte" and SS3 "ESC O x".
+        [[nodiscard]] std::size_t nextKeyLength() const {
+            if (pendingInput.empty()) {
+                return 0;
+            }
+            if (pendingInput[0] != '\x1b' || pendingInput.size() == 1) {
+                // A single byte, or a UTF-8 character with its continuation bytes
+                std::size_t length = 1;
+                while (length < pendingInput.size() && (static_cast<unsigned char>(pendingInput[length]) & 0xC0) == 0x80
+                       && (static_cast<unsigned char>(pendingInput[0]) & 0x80) != 0) {
+                    length++;
+                }
+                return length;
+            }
+            if (pendingInput[1] == 'O') {
+                return pendingInput.size() >= 3 ? 3 : 0;
+            }
+            if (pendingInput[1] != '[') {
+                return 1; // Escape on its own, followed by another key
+            }
+            for (std::size_t i = 2; i < pendingInput.size(); i++) {
+                if (pendingInput[i] >= 0x40 && pendingInput[i] <= 0x7E) {
+                    return i + 1;
+                }
+            }
+            return 0;
+        }
+
+        void renderFrame() {
+            const auto start = std::chrono::steady_clock::now();
+            const KitReadGuard kit;
+
+            winsize size{};
+            if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+                screenRows = size.ws_row;
+                screenColumns = size.ws_col;
+            }
+            scroll(0, 0); // Keeps the viewport inside the table after a resize or a new filter
+
+            const std::size_t lastColumn = std::min(left + bodyColumns(), visibleColumns.size());
+            std::string frame = "\x1b[H| no ND   | ";
+            for (std::size_t i = left; i < lastColumn; i++) {
+                frame += kit->stacks[visibleColumns[i]].toString();
+                frame += " | ";
+            }
+            frame += "\x1b[K\r\n| ------- | ";
+            for (std::size_t i = left; i < lastColumn; i++) {
+                frame += "------- | ";
+            }
+            frame += "\x1b[K\r\n";
+
+            const std::size_t lastRow = std::min(top + bodyRows(), shutters.size());
+            for (std::size_t row = top; row < lastRow; row++) {
+                frame += "| ";
+                frame += shutters[row].toString();
+                frame += " | ";
+                for (std::size_t i = left; i < lastColumn; i++) {
+                    const bool highlighted = highlight == std::pair{row, visibleColumns[i]};
+                    frame += highlighted ? "\x1b[7m" : "";
+                    frame += cell(row, visibleColumns[i]);
+                    frame += highlighted ? "\x1b[0m | " : " | ";
+                }
+                frame += "\x1b[K\r\n";
+            }
+            frame += "\x1b[J";
+
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            frame += std::format("\x1b[{};1H\x1b[7m rows {}-{}/{} columns {}-{}/{} filter '{}' | {} us | {}"
+                                 "\x1b[0m\x1b[K", screenRows, top + 1, lastRow, shutters.size(), left + 1, lastColumn,
+                                 visibleColumns.size(), filter, elapsed, status);
+            writeAll(STDOUT_FILENO, frame);
+        }
+    };
+
+    int runTableViewer() {
+        TableViewer viewer;
+        return viewer.run();
+    }
+} // end of namespace
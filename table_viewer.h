@@ -0,0 +1,7 @@
+// Full screen viewer of the exposure table
+#pragma once
+
+namespace shutter_calculator {
+    // Shows the table of the current kit until q or Ctrl-C, fails without an interactive terminal
+    int runTableViewer();
+} // end of namespace
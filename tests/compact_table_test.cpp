@@ -0,0 +1,187 @@
+// Round trips and malformed input of the compact table codec. Every bad input has to be rejected without reading
+// past the end of the bytes, run it under -fsanitize=address to check that part too.
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compact_table.h"
+
+namespace {
+    using namespace shutter_calculator;
+
+    int failures = 0;
+
+    void check(const bool passed, const std::string_view what) {
+        if (!passed) {
+            std::fputs(std::format("FAILED: {}\n", what).c_str(), stderr);
+            failures++;
+        }
+    }
+
+    // Every stack of one and two filters of the kit, and the two hand picked stacks of three
+    std::vector<Filter> stacksOf(const std::span<const Filter> kit) {
+        std::vector<Filter> stacks;
+        for (std::size_t i = 0; i < kit.size(); i++) {
+            stacks.push_back(kit[i]);
+            for (std::size_t j = i + 1; j < kit.size(); j++) {
+                stacks.push_back(kit[i] + kit[j]);
+            }
+        }
+        stacks.push_back(kit[0] + kit[1] + kit[3]);
+        stacks.push_back(kit[0] + kit[2] + kit[3]);
+        return stacks;
+    }
+
+    // Header with a kit of one filter, the stacks and the ladder are appended by the caller
+    std::string oneFilterKit(const std::uint64_t stops) {
+        std::string bytes(1, static_cast<char>(CompactTable::version));
+        appendVarint(bytes, 1);
+        appendVarint(bytes, stops);
+        appendVarint(bytes, 2);
+        bytes += "1k";
+        return bytes;
+    }
+
+    std::uint64_t zigzagged(const std::int64_t value) {
+        return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+    }
+
+    void testRoundTrip() {
+        const auto stacks = stacksOf(filters);
+        const auto bytes = encodeCompactTable(filters, stacks, shutters);
+        check(bytes.has_value(), "the table encodes");
+        const auto table = bytes ? decodeCompactTable(*bytes) : std::nullopt;
+        check(table.has_value(), "the table decodes");
+        if (!table) {
+            return;
+        }
+
+        check(table->kit.size() == filters.size() && table->columns() == stacks.size() &&
+              table->ladder.size() == shutters.size(), "the decoded table has the same size");
+        for (std::size_t column = 0; column < table->columns(); column++) {
+            const Filter stack = table->stack(column);
+            check(stack.name == stacks[column].name && stack.stops == stacks[column].stops &&
+                  stack.count == stacks[column].count, std::format("stack {} decodes back", column));
+        }
+        for (std::size_t row = 0; row < shutters.size(); row++) {
+            check(table->ladder[row].toString() == shutters[row].toString(),
+                  std::format("shutter {} decodes back", row));
+            for (std::size_t column = 0; column < table->columns(); column++) {
+                check(table->cellText(row, column) == shutters[row].toStringWithFilterStops(stacks[column].stops),
+                      std::format("cell {} {} decodes back", row, column));
+            }
+        }
+    }
+
+    void testEncoderRejects() {
+        const std::vector<Filter> foreign = {{.stops = 5, .name = "32"}};
+        check(!encodeCompactTable(filters, foreign, shutters), "a stack not made of the kit filters is rejected");
+
+        const std::vector<Filter> empty = {{.stops = 0, .name = ""}};
+        check(!encodeCompactTable(filters, empty, shutters), "an empty stack is rejected");
+
+        const std::vector<Filter> longKit = {{.stops = 20, .name = "a"}, {.stops = 20, .name = "b"}};
+        const std::vector<Filter> longStack = {longKit[0] + longKit[1]};
+        check(!encodeCompactTable(longKit, longStack, shutters), "a stack above the maximal stops is rejected");
+
+        const std::vector<Filter> nineFilters(9, Filter{.stops = 1, .name = "2"});
+        check(!encodeCompactTable(nineFilters, {}, shutters), "a kit of more than 8 filters is rejected");
+    }
+
+    void testTruncated() {
+        const auto bytes = encodeCompactTable(filters, stacksOf(filters), shutters);
+        if (!bytes) {
+            return;
+        }
+        // The heap copy of each prefix lets the sanitizers catch a read past its end
+        for (std::size_t length = 0; length < bytes->size(); length++) {
+            const std::string prefix = bytes->substr(0, length);
+            check(!decodeCompactTable(prefix), std::format("the first {} bytes are rejected", length));
+        }
+        check(!decodeCompactTable(*bytes + '\0'), "a trailing byte is rejected");
+    }
+
+    void testMalformed() {
+        check(!decodeCompactTable(std::string(1, static_cast<char>(CompactTable::version + 1))),
+              "another version is rejected");
+
+        // Eleven continuation bytes are more than any 64-bit value needs
+        std::string overlong(1, static_cast<char>(CompactTable::version));
+        overlong.append(11, '\x80');
+        overlong += '\x01';
+        check(!decodeCompactTable(overlong), "an overlong kit size is rejected");
+
+        std::string nineFilters(1, static_cast<char>(CompactTable::version));
+        appendVarint(nineFilters, 9);
+        for (int i = 0; i < 9; i++) {
+            appendVarint(nineFilters, 1);
+            appendVarint(nineFilters, 1);
+            nineFilters += "2";
+        }
+        appendVarint(nineFilters, 0);
+        appendVarint(nineFilters, 0);
+        check(!decodeCompactTable(nineFilters), "a kit of more than 8 filters is rejected");
+
+        std::string longName(1, static_cast<char>(CompactTable::version));
+        appendVarint(longName, 1);
+        appendVarint(longName, 10);
+        appendVarint(longName, std::numeric_limits<std::uint64_t>::max());
+        check(!decodeCompactTable(longName), "a name longer than the input is rejected");
+
+        std::string strongFilter = oneFilterKit(CompactTable::maximalStops + 1);
+        appendVarint(strongFilter, 0);
+        appendVarint(strongFilter, 0);
+        check(!decodeCompactTable(strongFilter), "a filter above the maximal stops is rejected");
+
+        const auto withStacks = [](const std::string_view masks) {
+            std::string bytes = oneFilterKit(10);
+            appendVarint(bytes, masks.size());
+            bytes += masks;
+            appendVarint(bytes, 1);
+            appendVarint(bytes, zigzagged(400));
+            return bytes;
+        };
+        check(decodeCompactTable(withStacks("\x01")).has_value(), "a valid one filter table decodes");
+        check(!decodeCompactTable(withStacks(std::string_view("\x00", 1))), "an empty mask is rejected");
+        check(!decodeCompactTable(withStacks("\x02")), "a mask beyond the kit is rejected");
+
+        std::string manyStacks = oneFilterKit(10);
+        appendVarint(manyStacks, 1000);
+        manyStacks += "\x01";
+        check(!decodeCompactTable(manyStacks), "more stacks than bytes left is rejected");
+
+        const auto withShutter = [](const std::uint64_t stops, const std::int64_t shutter) {
+            std::string bytes = oneFilterKit(stops);
+            appendVarint(bytes, 1);
+            bytes += '\x01';
+            appendVarint(bytes, 1);
+            appendVarint(bytes, zigzagged(shutter));
+            return bytes;
+        };
+        check(!decodeCompactTable(withShutter(10, 0)), "a zero shutter is rejected");
+        check(!decodeCompactTable(withShutter(10, std::int64_t{1} << 40)), "a fraction beyond an int is rejected");
+        check(!decodeCompactTable(withShutter(10, -(std::int64_t{1} << 40))), "tenths beyond an int are rejected");
+        check(!decodeCompactTable(withShutter(CompactTable::maximalStops, -300)),
+              "a cell whose seconds don't fit an int is rejected");
+        check(decodeCompactTable(withShutter(CompactTable::maximalStops, 4000)).has_value(),
+              "the longest stack on a short shutter decodes");
+    }
+} // end of namespace
+
+int main() {
+    testRoundTrip();
+    testEncoderRejects();
+    testTruncated();
+    testMalformed();
+    if (failures > 0) {
+        std::fputs(std::format("{} checks failed\n", failures).c_str(), stderr);
+        return 1;
+    }
+    return 0;
+}